@@ -6,11 +6,22 @@
 #include "endpoints.h"
 #include "hal_i2c_common.h"
 #include "mcp342x.h"
+#include "mcp342x_dsp.h"
+#include "mcp342x_energy.h"
+#include "mcp342x_frame.h"
+#include "mcp342x_log.h"
+#include "mcp342x_modbus.h"
 #include "printfx.h"
 #include "syslog.h"
 #include "systiming.h"								// timing debugging
 #include "errors_events.h"
 #include "string_general.h"
+#include "rules.h"
+
+#include "esp_timer.h"
+
+#include <math.h>
+#include <stdlib.h>
 
 #define	debugFLAG					0xF000
 
@@ -62,17 +73,49 @@
 #define	MCP342X_T_SNS_MIN			250
 #define	MCP342X_T_SNS				15000
 
+#define	mcp342xHIRES_TIMER			1					// 1 = microsecond esp_timer, 0 = RTOS tick only
+
+#define	mcp342xRETRY_MAX			15					// nRDY re-reads before conversion abandoned
+#define	mcp342xPOLL_US				1000				// tight poll interval near deadline
+#define	mcp342xCAL_LO				50					// calibration band, % of mcp342xDelay[Rate]
+#define	mcp342xCAL_HI				150
+#define	mcp342xTIME_US()			((u32_t) esp_timer_get_time())
+
+#define	mcp342xHDR_AUTO_HI			0.75				// auto range, step gain down above this fraction of FS
+#define	mcp342xHDR_CAL_MIN			64					// minimum |code| at lower gain to cross calibrate
+#define	mcp342xHDR_CAL_TOL			0.05				// reject cross calibration pairs outside +-5%
+
+#define	mcp342xBUS_WIN_US			1000000				// utilization window
+#define	mcp342xBUS_LIMIT			70					// default alarm threshold, %
+
+#define	mcp342xSHED_MAX				3					// default max level, low priority at 1/8 rate
+#define	mcp342xSHED_CALM			5					// windows below limits before level lowered
+#define	mcp342xSHED_HYST			10					// % below limits counted as calm
+
 // ###################################### Local variables ##########################################
 
 mcp342x_t *	psaMCP342X = NULL;
 epw_t *	psaMCP342X_EP = NULL;
+mcp342x_smp_t * psaMCP342X_SS = NULL;				// sample store, 1 entry per logical channel
+static mcp342x_hdr_t * psaHDR[mcp342xMAX_CH] = { NULL };	// HDR state, allocated when enabled
+static mcp342x_seq_t saSeq[mcp342xMAX_CH] = { 0 };		// sequence numbers, sweeps & bursts
+static mcp342x_sub_t saSub[mcp342xMAX_CH] = { 0 };		// subscribers & idle policy
+static u32_t saQFull[mcp342xMAX_DEV] = { 0 };			// esp_timer expiries deferred, timer queue full
 u8_t mcp342xNumDev = 0, mcp342xNumCh = 0;
+mcp342x_bus_t saMCP342X_Bus[mcp342xNUM_BUS] = {
+	[0 ... (mcp342xNUM_BUS - 1)] = { .Limit = mcp342xBUS_LIMIT },
+};
+static mcp342x_shed_t sShed = { .MaxLevel = mcp342xSHED_MAX };
+static SemaphoreHandle_t mcp342xCfgMux = NULL;		// config writers only, never the sense path
+static SemaphoreHandle_t mcp342xHdrMux = NULL;		// psaHDR[] swaps vs report copies, never waited on holding
 
 // ################################ Forward function declaration ###################################
 
 epw_t * mcp342xGetWork(int x);
 void mcp342xSetDefault(epw_t * psEWP, epw_t *psEWS);
 void mcp342xSetSense(epw_t * psEWP, epw_t * psEWS);
+static void mcp342xTimerHdlr(TimerHandle_t xTimer);
+static void mcp342xBurstEnd(mcp342x_t * psMCP342X);
 
 // ######################################### Constants #############################################
 
@@ -90,11 +133,1120 @@ const vt_enum_t	sMCP342XFunc = {
 	.report = NULL,
 };
 
+// ################################ Local ONLY utility functions ###################################
+
+static mcp342x_t * mcp342xGetDev(int LogCh) {
+	for (int eDev = 0; eDev < mcp342xNumDev; ++eDev) {
+		mcp342x_t * psMCP342X = &psaMCP342X[eDev];
+		if (LogCh >= psMCP342X->ChLo && LogCh <= psMCP342X->ChHi) return psMCP342X;
+	}
+	return NULL;
+}
+
+static int mcp342xGetMode(u32_t Modes, int ch) { return (Modes >> (ch << 1)) & 0x03; }
+
+/**
+ * mcp342xNextChan() - find next enabled channel on a device
+ * @return	channel number or -1 if no enabled channel after ch
+ */
+static int mcp342xNextChan(mcp342x_t * psMCP342X, int ch) {
+	while (++ch < psMCP342X->NumCh) {
+		if (mcp342xGetMode(psMCP342X->Modes, ch) != mcp342xM0) return ch;
+	}
+	return -1;
+}
+
+/**
+ * mcp342xTimerArm() - (re)start the device timer
+ * @note	High resolution one-shot if available, else RTOS timer with period rounded UP to whole ticks
+ */
+static void mcp342xTimerArm(mcp342x_t * psMCP342X, u32_t uS) {
+	if (psMCP342X->hrt) {
+		esp_timer_stop(psMCP342X->hrt);					// ignore error if not running
+		if (esp_timer_start_once(psMCP342X->hrt, uS) == ESP_OK) return;
+	}
+	TickType_t Ticks = ((u64_t) uS * configTICK_RATE_HZ + 999999) / 1000000;
+	xTimerChangePeriod(psMCP342X->th, Ticks ? Ticks : 1, 0);
+}
+
+/**
+ * mcp342xBusUs() - estimated bus time for a transaction, START + address + data bytes + STOP
+ */
+static u32_t mcp342xBusUs(mcp342x_t * psMCP342X, size_t Len) {
+	u32_t KHz = (psMCP342X->psI2C->Speed == i2cSPEED_400) ? 400 : 100;
+	return (((Len + 1) * 9 + 2) * 1000 + KHz - 1) / KHz;
+}
+
+/**
+ * mcp342xBusRoll() - close utilization window(s) elapsed, track peak and raise/clear alarm
+ */
+static void mcp342xBusRoll(int Port, mcp342x_bus_t * psBus, u32_t tNow) {
+	u32_t Span = tNow - psBus->tWin;
+	if (Span < mcp342xBUS_WIN_US) return;
+	psBus->SpanUs += Span;
+	psBus->PctNow = ((u64_t) psBus->WinUs * 10000) / Span;
+	if (psBus->PctNow > psBus->PctPeak) {
+		psBus->PctPeak = psBus->PctNow;
+		psBus->tPeak = (esp_timer_get_time() - Span) / 1000000;	// 64 bit clock, tWin wraps
+	}
+	int Alarm = (psBus->PctNow > (psBus->Limit * 100));
+	if (Alarm && psBus->Alarm == 0) SL_WARN("MCP342X bus %d utilization %d.%02d%% > %d%%", Port, psBus->PctNow / 100, psBus->PctNow % 100, psBus->Limit);
+	psBus->Alarm = Alarm;
+	psBus->tWin = tNow;
+	psBus->WinUs = 0;
+}
+
+/**
+ * mcp342xBusAdd() - account for a transaction on the device bus
+ * @return	estimated bus time of the transaction, uS
+ */
+static u32_t mcp342xBusAdd(mcp342x_t * psMCP342X, size_t Len) {
+	int Port = psMCP342X->psI2C->Port;
+	mcp342x_bus_t * psBus = &saMCP342X_Bus[Port];
+	u32_t tNow = mcp342xTIME_US();
+	if (psBus->tWin == 0) psBus->tWin = tNow;
+	mcp342xBusRoll(Port, psBus, tNow);
+	u32_t uS = mcp342xBusUs(psMCP342X, Len);
+	psBus->WinUs += uS;
+	psBus->BusyUs += uS;
+	return uS;
+}
+
+/**
+ * mcp342xBusConv() - modelled bus time for one conversion, config write plus average reads
+ */
+static u32_t mcp342xBusConv(mcp342x_t * psMCP342X, u8_t Rate) {
+	mcp342x_wstat_t * psWS = &psMCP342X->sWS[psMCP342X->Wait];
+	u32_t Reads100 = psWS->Conv ? (u32_t) (((u64_t) psWS->Reads * 100) / psWS->Conv) : 100;
+	size_t Len = (Rate == mcp342xR18_3_75) ? 4 : 3;
+	return mcp342xBusUs(psMCP342X, sizeof(mcp342x_cfg_t)) + ((mcp342xBusUs(psMCP342X, Len) * Reads100) / 100);
+}
+
+/**
+ * mcp342xBusDevModel() - worst case device utilization, sweeping back to back, 0.01% units
+ */
+static u32_t mcp342xBusDevModel(mcp342x_t * psMCP342X, mcp342x_cfg_t * psChan, u32_t Modes) {
+	u32_t BusUs = 0, ConvUs = 0;
+	for (int ch = 0; ch < psMCP342X->NumCh; ++ch) {
+		if (mcp342xGetMode(Modes, ch) == mcp342xM0) continue;
+		BusUs += mcp342xBusConv(psMCP342X, psChan[ch].RATE);
+		ConvUs += psMCP342X->Cal[psChan[ch].RATE] + mcp342xBusUs(psMCP342X, sizeof(mcp342x_cfg_t));
+	}
+	return ConvUs ? ((u64_t) BusUs * 10000) / ConvUs : 0;
+}
+
+/**
+ * mcp342xBusCheck() - check modelled utilization of published config against the bus limit
+ * @note	Called with mcp342xCfgMux held, other devices on the bus use their live config
+ */
+static void mcp342xBusCheck(mcp342x_t * psMCP342X) {
+	int Port = psMCP342X->psI2C->Port;
+	mcp342x_bus_t * psBus = &saMCP342X_Bus[Port];
+	u32_t Pct = mcp342xBusDevModel(psMCP342X, psMCP342X->Stage, psMCP342X->StageModes);
+	for (int eDev = 0; eDev < mcp342xNumDev; ++eDev) {
+		mcp342x_t * psDev = &psaMCP342X[eDev];
+		if (psDev != psMCP342X && psDev->psI2C->Port == Port) Pct += mcp342xBusDevModel(psDev, psDev->Chan, psDev->Modes);
+	}
+	int Warn = (Pct > (psBus->Limit * 100));
+	if (Warn && psBus->Warn == 0) SL_WARN("MCP342X bus %d modelled utilization %lu.%02lu%% > %d%%", Port, Pct / 100, Pct % 100, psBus->Limit);
+	psBus->Warn = Warn;
+}
+
+/**
+ * mcp342xShedRoll() - close CPU window, raise or lower the load shedding level
+ * @note	Overload is a measured bus window over its Limit or CPU over CpuLimit. The level
+ *			rises one step per overloaded window and falls one step after mcp342xSHED_CALM
+ *			windows with every measure more than mcp342xSHED_HYST % below its limit.
+ */
+static void mcp342xShedRoll(u32_t tNow) {
+	u32_t Span = tNow - sShed.tWin;
+	if (Span < mcp342xBUS_WIN_US) return;
+#if (configGENERATE_RUN_TIME_STATS == 1)
+	u32_t Idle = ulTaskGetIdleRunTimeCounter();			// esp_timer uS, timer task core
+	u32_t Busy = Span - ((Idle - sShed.Idle) < Span ? (Idle - sShed.Idle) : Span);
+	sShed.Idle = Idle;
+#else
+	u32_t Busy = sShed.WinUs;							// sense processing only
+#endif
+	sShed.CpuPct = ((u64_t) Busy * 10000) / Span;
+	if (sShed.CpuPct > sShed.CpuPeak) sShed.CpuPeak = sShed.CpuPct;
+	sShed.tWin = tNow;
+	sShed.WinUs = 0;
+	int Over = (sShed.CpuLimit && sShed.CpuPct > sShed.CpuLimit * 100);
+	int Calm = (sShed.CpuLimit == 0 || sShed.CpuPct < (sShed.CpuLimit - mcp342xSHED_HYST) * 100);
+	for (int Port = 0; Port < mcp342xNUM_BUS; ++Port) {
+		mcp342x_bus_t * psBus = &saMCP342X_Bus[Port];
+		if (psBus->tWin == 0) continue;
+		mcp342xBusRoll(Port, psBus, tNow);
+		if (psBus->Alarm) Over = 1;
+		if (psBus->PctNow >= (psBus->Limit - mcp342xSHED_HYST) * 100) Calm = 0;
+	}
+	if (Over && sShed.Level < sShed.MaxLevel) {
+		if (sShed.Level++ == 0) SL_WARN("MCP342X overload, shedding low priority channels");
+		++sShed.Raised;
+	} else if (sShed.Level > sShed.MaxLevel) {
+		sShed.Level = sShed.MaxLevel;
+	}
+	sShed.Calm = Calm ? sShed.Calm + 1 : 0;
+	if (sShed.Level && sShed.Calm >= mcp342xSHED_CALM) {
+		--sShed.Level;
+		++sShed.Lowered;
+		sShed.Calm = 0;
+	}
+}
+
+/**
+ * mcp342xShedAdd() - account sense processing time (timer task) & evaluate shedding each window
+ */
+static void mcp342xShedAdd(u32_t tStart) {
+	u32_t tNow = mcp342xTIME_US();
+	if (sShed.tWin == 0) sShed.tWin = tStart;
+	sShed.WinUs += tNow - tStart;
+	mcp342xShedRoll(tNow);
+}
+
+/**
+ * mcp342xWaitFirst() - delay from conversion start to the first nRDY read, per wait strategy
+ */
+static u32_t mcp342xWaitFirst(mcp342x_t * psMCP342X, u8_t Rate) {
+	u32_t Cal = psMCP342X->Cal[Rate];
+	switch (psMCP342X->Wait) {
+	case mcp342xWAIT_POLL:		return Cal / 4;
+	case mcp342xWAIT_HYBRID:	return Cal - (Cal / 16);
+	default:					return psMCP342X->hrt ? Cal + (Cal / 32) : mcp342xDelay[Rate] * 1000;
+	}
+}
+
+/**
+ * mcp342xWaitNext() - delay between subsequent nRDY reads, per wait strategy
+ */
+static u32_t mcp342xWaitNext(mcp342x_t * psMCP342X, u8_t Rate) {
+	switch (psMCP342X->Wait) {
+	case mcp342xWAIT_POLL:		return psMCP342X->Cal[Rate] / 4;
+	case mcp342xWAIT_HYBRID:	return mcp342xPOLL_US;
+	default:					return psMCP342X->hrt ? mcp342xPOLL_US : 1000000 / configTICK_RATE_HZ;
+	}
+}
+
+/**
+ * mcp342xWaitDone() - update wait statistics and calibration when a result is read
+ * @note	Calibration only uses results bracketed by a not ready read close enough to give
+ *			a tight estimate of the actual conversion time, the midpoint of the bracket.
+ */
+static void mcp342xWaitDone(mcp342x_t * psMCP342X, u8_t Rate, u32_t tNow) {
+	mcp342x_wstat_t * psWS = &psMCP342X->sWS[psMCP342X->Wait];
+	++psWS->Conv;
+	psWS->LatUs += tNow - psMCP342X->tStart;
+	if (psMCP342X->NoCal || psMCP342X->tNotRdy == 0 || (tNow - psMCP342X->tNotRdy) > (psMCP342X->Cal[Rate] / 4)) return;
+	// differences only, timestamps wrap after ~71 minutes
+	u32_t Est = (psMCP342X->tNotRdy - psMCP342X->tStart) + (tNow - psMCP342X->tNotRdy) / 2;
+	u32_t Lo = mcp342xDelay[Rate] * (10 * mcp342xCAL_LO), Hi = mcp342xDelay[Rate] * (10 * mcp342xCAL_HI);
+	if (Est < Lo) Est = Lo;
+	else if (Est > Hi) Est = Hi;
+	psMCP342X->Cal[Rate] = (i32_t) psMCP342X->Cal[Rate] + (((i32_t) Est - (i32_t) psMCP342X->Cal[Rate]) / 8);
+}
+
+/**
+ * mcp342xDecode() - extract signed conversion code from data bytes read
+ */
+static i32_t mcp342xDecode(mcp342x_cfg_t sCfg, u8_t * pu8Buf) {
+	if (sCfg.RATE == mcp342xR18_3_75) {
+		i32_t Code = ((pu8Buf[mcp342xR0] & 0x03) << 16) | (pu8Buf[mcp342xR1] << 8) | pu8Buf[mcp342xR2];
+		return (Code ^ 0x20000) - 0x20000;				// sign extend 18 bit value, no shift into sign bit
+	}
+	return (i16_t) ((pu8Buf[mcp342xR0] << 8) | pu8Buf[mcp342xR1]);	// 12/14 bit pre-extended by device
+}
+
+/**
+ * mcp342xRead() - read the minimum bytes holding result and config, 3 (12/14/16 bit) or 4 (18 bit)
+ * @param	psWS - sweep wait statistics to count the read in, NULL for burst reads (no matching Conv)
+ * @return	erSUCCESS with device config byte in *psCfg, else error code
+ */
+static int mcp342xRead(mcp342x_t * psMCP342X, u8_t Rate, u8_t * pu8Buf, mcp342x_cfg_t * psCfg, mcp342x_wstat_t * psWS) {
+	size_t Len = (Rate == mcp342xR18_3_75) ? 4 : 3;
+	u32_t uS = mcp342xBusAdd(psMCP342X, Len);
+	if (psWS) {
+		++psWS->Reads;
+		psWS->BusUs += uS;
+	}
+	int iRV = halI2C_Queue(psMCP342X->psI2C, i2cR_B, NULL, 0, pu8Buf, Len, (i2cq_p1_t) NULL, (i2cq_p2_t) (u32_t) 0);
+	if (iRV >= erSUCCESS) psCfg->Conf = pu8Buf[Len - 1];
+	return iRV;
+}
+
+/**
+ * mcp342xLSB() - Volts per code at the configured resolution and gain
+ */
+static double mcp342xLSB(mcp342x_cfg_t sCfg) { return 2.048 / (double) (1 << (11 + (sCfg.RATE << 1) + sCfg.PGA)); }
+
+static i32_t mcp342xCodeMax(u8_t Rate) { return (1 << (11 + (Rate << 1))) - 1; }
+
+static int mcp342xClipped(i32_t Code, u8_t Rate) {
+	i32_t Max = mcp342xCodeMax(Rate);
+	return (Code >= Max || Code < -Max);
+}
+
+// ################################# High dynamic range support ####################################
+
+/**
+ * mcp342xHdrGain() - select PGA for the next conversion of an HDR channel
+ */
+static u8_t mcp342xHdrGain(int LogCh, mcp342x_cfg_t sCfg) {
+	mcp342x_hdr_t * psH = psaHDR[LogCh];
+	if (psH == NULL || psH->Mode == mcp342xHDR_OFF) return sCfg.PGA;
+	return psH->Next;
+}
+
+/**
+ * mcp342xHdrCal() - cross calibrate gain B against gain A from two unclipped readings
+ * @note	Corr[G1] is the reference, the other gain's correction tracks by EWMA
+ */
+static void mcp342xHdrCal(mcp342x_hdr_t * psH, u8_t Rate, u8_t gA, u8_t gB) {
+	if (gA == gB) return;
+	if (gA > gB) { u8_t gT = gA; gA = gB; gB = gT; }	// gA lower gain
+	i32_t cA = psH->Code[gA], cB = psH->Code[gB];
+	if (abs(cA) < mcp342xHDR_CAL_MIN || mcp342xClipped(cA, Rate) || mcp342xClipped(cB, Rate)) return;
+	float Meas = (float) cB / (float) (cA * (1 << (gB - gA)));	// measured / nominal gain ratio
+	if (fabsf(Meas - 1.0f) > mcp342xHDR_CAL_TOL) return;	// signal moved between readings
+	float Est = psH->Corr[gA] * Meas;
+	psH->Corr[gB] += (Est - psH->Corr[gB]) / 16.0f;
+}
+
+/**
+ * mcp342xHdrMerge() - update HDR state with a new reading and select the value to store
+ * @note	Result is the highest gain unclipped reading from this or the previous sweep,
+ *			code divided by the gain correction so it scales correctly with its Cfg.
+ */
+static void mcp342xHdrMerge(mcp342x_t * psMCP342X, int LogCh, mcp342x_smp_t * psSmp) {
+	mcp342x_hdr_t * psH = psaHDR[LogCh];
+	if (psH == NULL || psH->Mode == mcp342xHDR_OFF) return;
+	u8_t Rate = psSmp->Cfg.RATE, gNow = psSmp->Cfg.PGA;
+	u32_t Sweep = psMCP342X->sSched.Sweeps + 1;			// 1 based, 0 = no reading at this PGA
+	if (Rate != psH->Rate) {
+		memset(psH->Sweep, 0, sizeof(psH->Sweep));
+		psH->Rate = Rate;
+	}
+	psH->Code[gNow] = psSmp->Code;
+	psH->Sweep[gNow] = Sweep;
+	int gBest = -1;
+	for (int g = mcp342xG8; g >= mcp342xG1; --g) {		// highest gain unclipped recent reading
+		if (psH->Sweep[g] == 0 || (Sweep - psH->Sweep[g]) > 1 || mcp342xClipped(psH->Code[g], Rate)) continue;
+		gBest = g;
+		break;
+	}
+	for (int g = mcp342xG1; g <= mcp342xG8; ++g) {		// cross calibrate against previous reading
+		if (g != gNow && psH->Sweep[g] && (Sweep - psH->Sweep[g]) <= 1) mcp342xHdrCal(psH, Rate, g, gNow);
+	}
+	if (gBest >= 0) {
+		psSmp->Code = (i32_t) lroundf((float) psH->Code[gBest] / psH->Corr[gBest]);
+		psSmp->Cfg.PGA = gBest;
+		psSmp->Flags = mcp342xSF_VALID | mcp342xSF_HDR;
+	}
+	if (psH->Mode == mcp342xHDR_DUAL) {
+		psH->Next = (gNow == psH->Hi) ? psH->Lo : psH->Hi;
+	} else {											// AUTO, highest gain keeping headroom
+		float Frac = fabsf((float) psH->Code[gNow]) / (float) mcp342xCodeMax(Rate);
+		float Vfs = Frac / (float) (1 << gNow);			// fraction of G1 full scale
+		int g = mcp342xG8;
+		while (g > mcp342xG1 && (Vfs * (float) (1 << g)) > mcp342xHDR_AUTO_HI) --g;
+		psH->Next = mcp342xClipped(psH->Code[gNow], Rate) ? mcp342xG1 : g;
+	}
+}
+
+/**
+ * mcp342xSSOpen() & mcp342xSSClose() - bracket sample store updates of a device for seqlock readers
+ * @note	Single writer per device, the timer task while Busy else the sense path holding the mux
+ */
+static void mcp342xSSOpen(mcp342x_t * psMCP342X) {
+	++psMCP342X->SSeq;
+	__sync_synchronize();
+}
+
+static void mcp342xSSClose(mcp342x_t * psMCP342X) {
+	__sync_synchronize();
+	++psMCP342X->SSeq;
+}
+
+/**
+ * mcp342xSyncEP() - refresh endpoint (view) values of channels stored during the sweep
+ * @note	Once per sweep, not per conversion, so endpoint consumers see a whole sweep change together
+ */
+static void mcp342xSyncEP(mcp342x_t * psMCP342X) {
+	for (int ch = 0; psMCP342X->Dirty; ++ch) {
+		if ((psMCP342X->Dirty & (1 << ch)) == 0) continue;
+		psMCP342X->Dirty &= ~(1 << ch);
+		int LogCh = psMCP342X->ChLo + ch;
+		x64_t X64 = { .f64 = mcp342xSampleVolts(&psaMCP342X_SS[LogCh]) };
+		vCV_SetValueRaw(&psaMCP342X_EP[LogCh].var, X64);
+	}
+}
+
+/**
+ * mcp342xStore() - save completed conversion in the sample store, only raw code & config kept
+ */
+static void mcp342xStore(mcp342x_t * psMCP342X, int ch, mcp342x_cfg_t sCfg, u8_t * pu8Buf, u32_t tNow) {
+	int LogCh = psMCP342X->ChLo + ch;
+	mcp342x_smp_t sSmp = { .Code = mcp342xDecode(sCfg, pu8Buf), .Time = tNow, .Cfg = sCfg };
+	sSmp.Flags = mcp342xSF_VALID | (mcp342xClipped(sSmp.Code, sCfg.RATE) ? mcp342xSF_CLIP : 0);
+	sSmp.Seq = saSeq[LogCh].Next++;
+	mcp342xSSOpen(psMCP342X);							// HDR state changes under the seqlock too
+	mcp342xHdrMerge(psMCP342X, LogCh, &sSmp);
+	psaMCP342X_SS[LogCh] = sSmp;
+	mcp342xSSClose(psMCP342X);
+	psMCP342X->Dirty |= 1 << ch;
+	mcp342xDspFeed(LogCh, &sSmp);
+	mcp342xEnergyFeed(LogCh, &sSmp);
+	mcp342xLogPush(LogCh, &sSmp);
+}
+
+static void mcp342xFree(void * pvPara, u32_t u32Para) { vRtosFree(pvPara); }
+
+/**
+ * mcp342xRetire() - release channel state once the timer task can no longer be using it
+ * @note	Samples are stored and fed from the RTOS timer task, so a free queued to the same
+ *			task can never overlap a feed still using the memory. The timer task itself must
+ *			never wait on its own queue, it frees directly if the queue is full as no feed can
+ *			be in progress while it is retiring.
+ */
+void mcp342xRetire(void * pvMem) {
+	if (pvMem == NULL) return;
+	if (xTaskGetCurrentTaskHandle() == xTimerGetTimerDaemonTaskHandle()) {
+		if (xTimerPendFunctionCall(mcp342xFree, pvMem, 0, 0) != pdPASS) vRtosFree(pvMem);
+	} else if (xTimerPendFunctionCall(mcp342xFree, pvMem, 0, portMAX_DELAY) != pdPASS) {
+		SL_ERR("MCP342X channel state leaked");
+	}
+}
+
+/**
+ * mcp342xRelease() - free all run time state of a channel that has been disabled (M0)
+ * @note	Config (Chan[], deadline, priority & idle policy) is kept for when it is re-enabled
+ */
+static void mcp342xRelease(mcp342x_t * psMCP342X, int ch) {
+	int LogCh = psMCP342X->ChLo + ch;
+	xRtosSemaphoreTake(&mcp342xHdrMux, portMAX_DELAY);
+	mcp342x_hdr_t * psH = __atomic_exchange_n(&psaHDR[LogCh], NULL, __ATOMIC_ACQ_REL);
+	xRtosSemaphoreGive(&mcp342xHdrMux);
+	mcp342xRetire(psH);
+	mcp342xDspRelease(LogCh);
+	mcp342xLogRelease(LogCh);
+	mcp342xSSOpen(psMCP342X);
+	psaMCP342X_SS[LogCh].Flags = 0;						// no longer valid
+	mcp342xSSClose(psMCP342X);
+}
+
+/**
+ * mcp342xAdopt() - make the latest published config live, must be called with device mux held
+ * @note	Only called at a sweep boundary, no conversion in flight. The descriptor is taken
+ *			with an atomic swap so writers never wait on the sense path, and retired through
+ *			the timer task as mcp342xStep() may still be peeking at it.
+ *			Channels disabled are released, if none remain a device left converting continuously
+ *			is switched to one-shot so that it enters standby.
+ */
+static void mcp342xAdopt(mcp342x_t * psMCP342X) {
+	mcp342x_desc_t * psD = __atomic_exchange_n(&psMCP342X->psNext, NULL, __ATOMIC_ACQ_REL);
+	if (psD == NULL) return;
+	u8_t Gone = 0;
+	for (int ch = 0; ch < psMCP342X->NumCh; ++ch) {
+		if (mcp342xGetMode(psMCP342X->Modes, ch) != mcp342xM0 && mcp342xGetMode(psD->Modes, ch) == mcp342xM0) {
+			Gone |= 1 << ch;
+		}
+	}
+	memcpy(psMCP342X->Chan, psD->Chan, sizeof(psMCP342X->Chan));
+	psMCP342X->Modes = psD->Modes;
+	psMCP342X->Ver = psD->Ver;
+	mcp342xRetire(psD);
+	for (int ch = 0; Gone; ++ch, Gone >>= 1) {
+		if (Gone & 1) mcp342xRelease(psMCP342X, ch);
+	}
+	mcp342x_sched_t * psS = &psMCP342X->sSched;
+	if (psMCP342X->Modes == 0 && psS->DevCfg.OS_C) {
+		mcp342x_cfg_t sCfg = psS->DevCfg;
+		sCfg.OS_C = 0;									// one-shot without starting a conversion
+		sCfg.nRDY = 0;
+		if (halI2C_Queue(psMCP342X->psI2C, i2cW_B, &sCfg.Conf, sizeof(sCfg), NULL, 0, (i2cq_p1_t) NULL, (i2cq_p2_t) (u32_t) 0) >= erSUCCESS) {
+			mcp342xBusAdd(psMCP342X, sizeof(sCfg));
+		}
+		psS->DevCfg.Conf = 0;
+	}
+}
+
+/**
+ * mcp342xDemand() - decide if a channel needs converting this sweep
+ * @return	1 if subscribed, idle policy RUN or keep-alive sample due, else 0
+ */
+static int mcp342xDemand(int LogCh, u32_t tNow) {
+	mcp342x_sub_t * psSub = &saSub[LogCh];
+	if (psSub->Idle == mcp342xIDLE_RUN) return 1;
+	if ((psSub->Mask & mcp342xSUB_UI) && (i32_t) (esp_timer_get_time() / 1000000 - psSub->tLease) >= 0) {
+		psSub->Mask &= ~mcp342xSUB_UI;					// lease expired, for every UI subscriber
+		psSub->Cnt[__builtin_ctz(mcp342xSUB_UI)] = 0;
+	}
+	if (psSub->Mask) return 1;
+	if (psSub->Idle == mcp342xIDLE_PAUSE) return 0;
+	mcp342x_smp_t * psSmp = &psaMCP342X_SS[LogCh];
+	return (psSmp->Flags & mcp342xSF_VALID) == 0 || (tNow - psSmp->Time) >= (u32_t) psSub->KeepS * 1000000UL;
+}
+
+/**
+ * mcp342xPlan() - order the enabled channels of a device for the next sweep
+ * @return	number of channels to convert
+ * @note	Channels at risk of exceeding their deadline go first, earliest deadline first.
+ *			The rest are grouped by rate, fastest first, minimising the average sample age.
+ *			If the device is still converting a channel continuously with its current
+ *			config, that channel starts the sweep so its write (and wait) can be skipped.
+ *			While shedding load, low priority channels are only converted every 2^Level sweeps.
+ *			Channels without subscribers follow their idle policy, see mcp342xDemand().
+ *			Must be called with device mux held.
+ */
+static int mcp342xPlan(mcp342x_t * psMCP342X) {
+	mcp342x_sched_t * psS = &psMCP342X->sSched;
+	u32_t tNow = mcp342xTIME_US(), WrUs = mcp342xBusUs(psMCP342X, sizeof(mcp342x_cfg_t));
+	u32_t SweepUs = 0;
+	i32_t Slack[4];
+	int Num = 0;
+	int Skip = sShed.Level && (psS->Sweeps & ((1UL << sShed.Level) - 1));
+	for (int ch = mcp342xNextChan(psMCP342X, -1); ch >= 0; ch = mcp342xNextChan(psMCP342X, ch)) {
+		if (Skip && (psS->LowPri & (1 << ch))) {		// shedding, low priority this sweep
+			++psS->Shed;
+			continue;
+		}
+		if (mcp342xDemand(psMCP342X->ChLo + ch, tNow) == 0) {
+			++psS->Idle;
+			continue;
+		}
+		psS->Order[Num++] = ch;
+		SweepUs += psMCP342X->Cal[psMCP342X->Chan[ch].RATE] + WrUs;
+	}
+	if (Num == 0 && Skip) ++psS->Sweeps;				// all shed, count the empty sweep to advance
+	for (int i = 0; i < Num; ++i) {						// slack = time left before deadline
+		int ch = psS->Order[i];
+		mcp342x_smp_t * psSmp = &psaMCP342X_SS[psMCP342X->ChLo + ch];
+		u32_t Age = (psSmp->Flags & mcp342xSF_VALID) ? tNow - psSmp->Time : 0;
+		Slack[ch] = psS->DeadMs[ch] ? (i32_t) (psS->DeadMs[ch] * 1000) - (i32_t) Age : INT32_MAX;
+	}
+	for (int i = 1; i < Num; ++i) {						// insertion sort, at most 4 entries
+		for (int j = i; j > 0; --j) {
+			int a = psS->Order[j - 1], b = psS->Order[j];
+			int UrgA = Slack[a] < (i32_t) SweepUs, UrgB = Slack[b] < (i32_t) SweepUs;
+			int Swap = (UrgB && !UrgA) || (UrgA && UrgB && Slack[b] < Slack[a]) ||
+						(!UrgA && !UrgB && psMCP342X->Chan[b].RATE < psMCP342X->Chan[a].RATE);
+			if (!Swap) break;
+			psS->Order[j - 1] = b;
+			psS->Order[j] = a;
+		}
+	}
+	mcp342x_cfg_t sCfg = psMCP342X->Chan[psS->DevCfg.CHAN];
+	sCfg.nRDY = 1;
+	if (Num > 1 && sCfg.OS_C && psS->DevCfg.Conf == sCfg.Conf && Slack[psS->Order[0]] >= (i32_t) SweepUs) {
+		for (int i = 1; i < Num; ++i) {
+			if (psS->Order[i] != psS->DevCfg.CHAN) continue;
+			memmove(&psS->Order[1], &psS->Order[0], i);	// rotate continuing channel to the front
+			psS->Order[0] = psS->DevCfg.CHAN;
+			break;
+		}
+	}
+	u32_t tDone = 0;
+	for (int i = 0; i < Num; ++i) {						// predict deadline misses in planned order
+		int ch = psS->Order[i];
+		tDone += psMCP342X->Cal[psMCP342X->Chan[ch].RATE] + WrUs;
+		if (Slack[ch] != INT32_MAX && Slack[ch] < (i32_t) tDone) ++psS->Miss;
+	}
+	psS->PlanUs = SweepUs;								// counted only if the sweep completes
+	psS->NumOrd = Num;
+	psS->SwIdx = 0;
+	psS->tSweep = tNow;
+	return Num;
+}
+
+/**
+ * mcp342xConvStart() - write channel config to device and wait for conversion to complete
+ * @note	If the device is already converting the channel continuously with the same config
+ *			the write is skipped and the latest result read as soon as it is available.
+ */
+static int mcp342xConvStart(mcp342x_t * psMCP342X) {
+	mcp342x_sched_t * psS = &psMCP342X->sSched;
+	mcp342x_cfg_t sCfg = psMCP342X->Chan[psMCP342X->ChNow];
+	sCfg.PGA = mcp342xHdrGain(psMCP342X->ChLo + psMCP342X->ChNow, sCfg);
+	sCfg.nRDY = 1;										// initiate conversion
+	psMCP342X->tNotRdy = 0;
+	psMCP342X->Retry = 0;
+	psMCP342X->tStart = mcp342xTIME_US();
+	if (sCfg.OS_C && psS->DevCfg.Conf == sCfg.Conf) {
+		++psS->Saved;
+		psMCP342X->NoCal = 1;
+		// still converting continuously, next result due 1 conversion after the last one read
+		mcp342x_smp_t * psSmp = &psaMCP342X_SS[psMCP342X->ChLo + psMCP342X->ChNow];
+		u32_t Cal = psMCP342X->Cal[sCfg.RATE], Age = psMCP342X->tStart - psSmp->Time;
+		u32_t Wait = (psSmp->Flags & mcp342xSF_VALID) == 0 ? Cal : (Age < Cal) ? Cal - Age : 0;
+		mcp342xTimerArm(psMCP342X, (Wait > mcp342xPOLL_US) ? Wait : mcp342xPOLL_US);
+		return erSUCCESS;
+	}
+	psS->DevCfg.Conf = 0;
+	int iRV = halI2C_Queue(psMCP342X->psI2C, i2cW_B, &sCfg.Conf, sizeof(sCfg), NULL, 0, (i2cq_p1_t) NULL, (i2cq_p2_t) (u32_t) 0);
+	if (iRV < erSUCCESS) return iRV;
+	psMCP342X->sWS[psMCP342X->Wait].BusUs += mcp342xBusAdd(psMCP342X, sizeof(sCfg));
+	++psS->Writes;
+	psS->DevCfg = sCfg;
+	psMCP342X->NoCal = 0;
+	mcp342xTimerArm(psMCP342X, mcp342xWaitFirst(psMCP342X, sCfg.RATE));
+	return iRV;
+}
+
+/**
+ * mcp342xBurstStart() - switch burst channel to continuous mode at the burst rate & gain
+ */
+static int mcp342xBurstStart(mcp342x_t * psMCP342X) {
+	mcp342x_burst_t * psBurst = psMCP342X->psBurst;
+	mcp342x_cfg_t sCfg = { .Conf = 0 };
+	sCfg.CHAN = psBurst->LogCh - psMCP342X->ChLo;
+	sCfg.RATE = psBurst->RATE;
+	sCfg.PGA = psBurst->PGA;
+	sCfg.OS_C = 1;
+	sCfg.nRDY = 1;
+	psMCP342X->sSched.DevCfg.Conf = 0;
+	int iRV = halI2C_Queue(psMCP342X->psI2C, i2cW_B, &sCfg.Conf, sizeof(sCfg), NULL, 0, (i2cq_p1_t) NULL, (i2cq_p2_t) (u32_t) 0);
+	if (iRV < erSUCCESS) return iRV;
+	mcp342xBusAdd(psMCP342X, sizeof(sCfg));
+	psMCP342X->sSched.DevCfg = sCfg;
+	psMCP342X->BurstAct = 1;
+	psMCP342X->Retry = 0;
+	mcp342xTimerArm(psMCP342X, mcp342xDelay[sCfg.RATE] * 1000);
+	return iRV;
+}
+
+/**
+ * mcp342xSweepEnd() - sweep boundary, publish endpoints, adopt published config and release device
+ *			or start pending burst
+ */
+static void mcp342xSweepEnd(mcp342x_t * psMCP342X) {
+	mcp342xSyncEP(psMCP342X);
+	mcp342xFrameSweep(psMCP342X->ChLo, psMCP342X->ChHi);
+	xRtosSemaphoreTake(&psMCP342X->mux, portMAX_DELAY);
+	mcp342xAdopt(psMCP342X);
+	int Burst = (psMCP342X->psBurst && psMCP342X->BurstAct == 0);
+	if (Burst == 0) psMCP342X->Busy = 0;
+	xRtosSemaphoreGive(&psMCP342X->mux);
+	if (Burst && mcp342xBurstStart(psMCP342X) < erSUCCESS) {
+		psMCP342X->psBurst->Abort = 1;
+		mcp342xBurstEnd(psMCP342X);
+	}
+}
+
+/**
+ * mcp342xBurstEnd() - report burst completion and resume normal sweeps
+ */
+static void mcp342xBurstEnd(mcp342x_t * psMCP342X) {
+	mcp342x_burst_t * psBurst = psMCP342X->psBurst;
+	xRtosSemaphoreTake(&psMCP342X->mux, portMAX_DELAY);
+	psMCP342X->psBurst = NULL;
+	psMCP342X->BurstAct = 0;
+	xRtosSemaphoreGive(&psMCP342X->mux);
+	if (psBurst->cb) psBurst->cb(psBurst);
+	mcp342xSweepEnd(psMCP342X);
+}
+
+/**
+ * mcp342xBurstPoll() - short read polling nRDY, store each new continuous mode result
+ * @note	After a result the next poll is scheduled just before the following conversion
+ *			completes, thereafter every mcp342xPOLL_US until nRDY clears.
+ *			Each result also goes to the sample store, so its Seq is seen by store readers.
+ */
+static void mcp342xBurstPoll(mcp342x_t * psMCP342X) {
+	mcp342x_burst_t * psBurst = psMCP342X->psBurst;
+	u8_t u8Buf[4];
+	mcp342x_cfg_t sCfg;
+	++psBurst->Polls;
+	if (mcp342xRead(psMCP342X, psBurst->RATE, u8Buf, &sCfg, NULL) < erSUCCESS) {	// counted in Polls
+		psBurst->Abort = 1;
+	} else if (sCfg.nRDY == 0) {
+		mcp342x_smp_t sSmp = { .Code = mcp342xDecode(sCfg, u8Buf), .Time = mcp342xTIME_US(), .Cfg = sCfg,
+								.Flags = mcp342xSF_VALID, .Seq = saSeq[psBurst->LogCh].Next++ };
+		psBurst->pi32Buf[psBurst->Done++] = sSmp.Code;
+		mcp342xSSOpen(psMCP342X);						// published like sweep samples, no Seq gaps for readers
+		psaMCP342X_SS[psBurst->LogCh] = sSmp;
+		mcp342xSSClose(psMCP342X);
+		psMCP342X->Dirty |= 1 << (psBurst->LogCh - psMCP342X->ChLo);	// endpoint synced at burst end
+		mcp342xDspFeed(psBurst->LogCh, &sSmp);
+		mcp342xEnergyFeed(psBurst->LogCh, &sSmp);
+		mcp342xLogPush(psBurst->LogCh, &sSmp);
+		psMCP342X->Retry = 0;
+		if (psBurst->Done < psBurst->Count) {
+			u32_t Cal = psMCP342X->Cal[psBurst->RATE];
+			mcp342xTimerArm(psMCP342X, Cal - (Cal / 16));
+			return;
+		}
+	} else if (psMCP342X->Retry < mcp342xRETRY_MAX) {
+		++psMCP342X->Retry;
+		mcp342xTimerArm(psMCP342X, mcp342xPOLL_US);
+		return;
+	} else {
+		psBurst->Abort = 1;
+	}
+	mcp342xBurstEnd(psMCP342X);
+}
+
+/**
+ * mcp342xStep() - read completed conversion, store result and start next channel in sweep
+ * @note	Always runs in the RTOS timer task, whichever timer backend expired
+ */
+static void mcp342xStep(mcp342x_t * psMCP342X) {
+	if (psMCP342X->BurstAct) {
+		mcp342xBurstPoll(psMCP342X);
+		return;
+	}
+	u8_t u8Buf[4];
+	mcp342x_cfg_t sCfg = psMCP342X->Chan[psMCP342X->ChNow];
+	int iRV = mcp342xRead(psMCP342X, sCfg.RATE, u8Buf, &sCfg, &psMCP342X->sWS[psMCP342X->Wait]);
+	if (iRV >= erSUCCESS) {
+		u32_t tNow = mcp342xTIME_US();
+		u8_t Rate = psMCP342X->Chan[psMCP342X->ChNow].RATE;
+		if (sCfg.nRDY && psMCP342X->Retry < mcp342xRETRY_MAX) {	// conversion not yet complete
+			++psMCP342X->Retry;
+			psMCP342X->tNotRdy = tNow;
+			mcp342xTimerArm(psMCP342X, mcp342xWaitNext(psMCP342X, Rate));
+			return;
+		}
+		if (sCfg.nRDY == 0) {
+			mcp342xWaitDone(psMCP342X, Rate, tNow);
+			mcp342xStore(psMCP342X, psMCP342X->ChNow, psMCP342X->sSched.DevCfg, u8Buf, tNow);
+			++psMCP342X->sSched.Conv;
+		} else {
+			iRV = erFAILURE;							// nRDY timeout
+		}
+	}
+	if (iRV < erSUCCESS) {
+		int LogCh = psMCP342X->ChLo + psMCP342X->ChNow;
+		mcp342xSSOpen(psMCP342X);
+		psaMCP342X_SS[LogCh].Flags |= mcp342xSF_STALE;
+		mcp342xSSClose(psMCP342X);
+		++saSeq[LogCh].Next;							// consumers see the lost conversion as a gap
+		++saSeq[LogCh].Skip;
+		psMCP342X->sSched.DevCfg.Conf = 0;				// device state unknown, force next write
+	}
+	mcp342x_sched_t * psS = &psMCP342X->sSched;
+	while (++psS->SwIdx < psS->NumOrd) {
+		psMCP342X->ChNow = psS->Order[psS->SwIdx];
+		// disabled since the sweep was planned, give its time to the rest right away
+		mcp342x_desc_t * psD = __atomic_load_n(&psMCP342X->psNext, __ATOMIC_ACQUIRE);
+		if (psD && mcp342xGetMode(psD->Modes, psMCP342X->ChNow) == mcp342xM0) {
+			psS->PlanUs -= psMCP342X->Cal[psMCP342X->Chan[psMCP342X->ChNow].RATE] + mcp342xBusUs(psMCP342X, sizeof(mcp342x_cfg_t));
+			continue;
+		}
+		if (mcp342xConvStart(psMCP342X) >= erSUCCESS) return;
+		break;
+	}
+	++psS->Sweeps;										// also paces shedding & HDR, count aborted too
+	if (psS->SwIdx >= psS->NumOrd) {					// completed, aborted sweeps would skew the ratio
+		psS->SweepUs += mcp342xTIME_US() - psS->tSweep;
+		psS->NaiveUs += psS->PlanUs;
+	}
+	mcp342xSweepEnd(psMCP342X);
+}
+
+static void mcp342xTimerHdlr(TimerHandle_t xTimer) {
+	u32_t tStart = mcp342xTIME_US();
+	mcp342xStep(pvTimerGetTimerID(xTimer));
+	mcp342xShedAdd(tStart);
+}
+
+static void mcp342xPendHdlr(void * pvPara, u32_t u32Para) {
+	u32_t tStart = mcp342xTIME_US();
+	mcp342xStep(pvPara);
+	mcp342xShedAdd(tStart);
+}
+
+/**
+ * mcp342xHRTHdlr() - high resolution timer expiry, defer processing to the RTOS timer task
+ * @note	Keeps the esp_timer task free of I2C traffic and all sense processing in one task
+ */
+static void mcp342xHRTHdlr(void * pvPara) {
+	mcp342x_t * psMCP342X = pvPara;
+	if (xTimerPendFunctionCall(mcp342xPendHdlr, psMCP342X, 0, 0) != pdPASS) {
+		// timer queue full, so is the RTOS timer command queue, retry from esp_timer itself
+		++saQFull[psMCP342X - psaMCP342X];
+		if (esp_timer_start_once(psMCP342X->hrt, mcp342xPOLL_US) != ESP_OK) xTimerChangePeriod(psMCP342X->th, 1, 0);
+	}
+}
+
+// ################################### Sense related functions #####################################
+
+/**
+ * mcp342xSense() - start a sweep of all enabled channels on the device owning the endpoint
+ * @return	erSUCCESS if sweep started or already in progress, else error code
+ */
+int	mcp342xSense(epw_t * psEWx) {
+	IF_myASSERT(debugPARAM, psEWx >= psaMCP342X_EP && psEWx < &psaMCP342X_EP[mcp342xNumCh]);
+	mcp342x_t * psMCP342X = mcp342xGetDev(psEWx - psaMCP342X_EP);
+	if (psMCP342X == NULL) return erINV_PARA;
+	xRtosSemaphoreTake(&psMCP342X->mux, portMAX_DELAY);
+	int Num = 0;
+	if (psMCP342X->Busy == 0) {
+		mcp342xAdopt(psMCP342X);
+		Num = mcp342xPlan(psMCP342X);
+	}
+	if (Num) {
+		psMCP342X->Busy = 1;
+		psMCP342X->ChNow = psMCP342X->sSched.Order[0];
+	}
+	xRtosSemaphoreGive(&psMCP342X->mux);
+	if (Num == 0) return erSUCCESS;						// sweep in progress will cover this channel
+	int iRV = mcp342xConvStart(psMCP342X);
+	if (iRV < erSUCCESS) mcp342xSweepEnd(psMCP342X);
+	return iRV;
+}
+
+/**
+ * mcp342xBurst() - acquire back-to-back continuous mode conversions on a single channel
+ * @param	psBurst - caller owned, LogCh, RATE, PGA, pi32Buf, Count & cb set, must persist until cb
+ * @return	erSUCCESS if burst started or queued for the end of the sweep in progress
+ * @note	Raw signed codes are stored, scale with the burst RATE & PGA. Normal sweeps of the
+ *			device are suspended for the duration of the burst.
+ */
+int	mcp342xBurst(mcp342x_burst_t * psBurst) {
+	if (psaMCP342X == NULL) return erINV_STATE;
+	if (psBurst->LogCh >= mcp342xNumCh || psBurst->pi32Buf == NULL || psBurst->Count == 0) return erINV_PARA;
+	mcp342x_t * psMCP342X = mcp342xGetDev(psBurst->LogCh);
+	psBurst->Done = psBurst->Polls = 0;
+	psBurst->Abort = 0;
+	int iRV = erSUCCESS, Start = 0;
+	xRtosSemaphoreTake(&psMCP342X->mux, portMAX_DELAY);
+	if (psMCP342X->psBurst) {
+		iRV = erINV_STATE;								// one burst per device at a time
+	} else {
+		psMCP342X->psBurst = psBurst;
+		if (psMCP342X->Busy == 0) Start = psMCP342X->Busy = 1;
+	}
+	xRtosSemaphoreGive(&psMCP342X->mux);
+	if (Start) {
+		iRV = mcp342xBurstStart(psMCP342X);
+		if (iRV < erSUCCESS) {
+			psBurst->Abort = 1;
+			mcp342xBurstEnd(psMCP342X);
+		}
+	}
+	return iRV;
+}
+
+/**
+ * mcp342xConfigWait() - select conversion wait strategy
+ * @param	eDev - device index, -1 for all devices
+ * @param	Wait - mcp342xWAIT_TIMER, mcp342xWAIT_POLL or mcp342xWAIT_HYBRID
+ * @note	Takes effect from the next conversion started, statistics are kept per strategy
+ *			so bus occupancy and latency can be compared using mcp342xReportWait()
+ */
+int	mcp342xConfigWait(int eDev, int Wait) {
+	if (psaMCP342X == NULL) return erINV_STATE;
+	if (eDev >= mcp342xNumDev || OUTSIDE(mcp342xWAIT_TIMER, Wait, mcp342xWAIT_HYBRID)) return erINV_PARA;
+	for (int i = (eDev < 0) ? 0 : eDev; i < ((eDev < 0) ? mcp342xNumDev : eDev + 1); ++i) psaMCP342X[i].Wait = Wait;
+	return erSUCCESS;
+}
+
+/**
+ * mcp342xGetSample() - copy the latest sample of a logical channel from the sample store
+ * @return	erSUCCESS, erINV_STATE if no conversion yet, else error code
+ */
+int	mcp342xGetSample(int LogCh, mcp342x_smp_t * psSmp) {
+	if (psaMCP342X_SS == NULL) return erINV_STATE;
+	if (OUTSIDE(0, LogCh, mcp342xNumCh - 1)) return erINV_PARA;
+	u32_t Seq;
+	do {
+		Seq = mcp342xSnapBegin(LogCh);
+		*psSmp = psaMCP342X_SS[LogCh];
+	} while (mcp342xSnapRetry(LogCh, Seq));
+	return (psSmp->Flags & mcp342xSF_VALID) ? erSUCCESS : erINV_STATE;
+}
+
+/**
+ * mcp342xSnapBegin() & mcp342xSnapRetry() - seqlock read of sample store entries of a device
+ * @param	LogCh - any channel on the device, must be valid
+ * @note	Copy entries between the two, repeat if SnapRetry returns 1. Never blocks the writer.
+ *			A reader that finds a write open for mcp342xSNAP_SPIN polls sleeps a tick, so it
+ *			cannot starve a lower priority writer it preempted on the same core.
+ */
+u32_t mcp342xSnapBegin(int LogCh) {
+	mcp342x_t * psMCP342X = mcp342xGetDev(LogCh);
+	u32_t Seq;
+	for (int Spin = 0; (Seq = psMCP342X->SSeq) & 1; ) {
+		if (++Spin == mcp342xSNAP_SPIN) {
+			vTaskDelay(1);
+			Spin = 0;
+		}
+	}
+	__sync_synchronize();
+	return Seq;
+}
+
+int	mcp342xSnapRetry(int LogCh, u32_t Seq) {
+	__sync_synchronize();
+	return mcp342xGetDev(LogCh)->SSeq != Seq;
+}
+
+/**
+ * mcp342xGetVals() - fill results, entries on the same device copied under a single snapshot
+ */
+static int mcp342xGetVals(const u8_t * pu8Ch, int First, int Count, mcp342x_val_t * psOut) {
+	if (psaMCP342X_SS == NULL) return erINV_STATE;
+	for (int i = 0; i < Count; ++i) {
+		if (OUTSIDE(0, pu8Ch ? pu8Ch[i] : First + i, mcp342xNumCh - 1)) return erINV_PARA;
+	}
+	int iRV = 0;
+	for (int i = 0, n; i < Count; i += n) {
+		mcp342x_t * psMCP342X = mcp342xGetDev(pu8Ch ? pu8Ch[i] : First + i);
+		for (n = 1; i + n < Count; ++n) {				// run of entries on this device
+			int LogCh = pu8Ch ? pu8Ch[i + n] : First + i + n;
+			if (LogCh < psMCP342X->ChLo || LogCh > psMCP342X->ChHi) break;
+		}
+		u32_t Seq;
+		do {
+			Seq = mcp342xSnapBegin(psMCP342X->ChLo);
+			for (int j = i; j < i + n; ++j) {
+				mcp342x_smp_t * psSmp = &psaMCP342X_SS[pu8Ch ? pu8Ch[j] : First + j];
+				psOut[j].Volts = mcp342xSampleVolts(psSmp);
+				psOut[j].Time = psSmp->Time;
+				psOut[j].Seq = psSmp->Seq;
+				psOut[j].Flags = psSmp->Flags;
+			}
+		} while (mcp342xSnapRetry(psMCP342X->ChLo, Seq));
+		for (int j = i; j < i + n; ++j) {
+			psOut[j].LogCh = pu8Ch ? pu8Ch[j] : First + j;
+			if (psOut[j].Flags & mcp342xSF_VALID) ++iRV;
+		}
+	}
+	return iRV;
+}
+
+/**
+ * mcp342xGetRange() - latest values of consecutive logical channels in one call
+ * @return	number of entries holding a valid sample, or error code
+ * @note	Volts as stored, endpoint (rule) offset & factor not applied
+ */
+int	mcp342xGetRange(int LogCh, int Count, mcp342x_val_t * psOut) {
+	return mcp342xGetVals(NULL, LogCh, Count, psOut);
+}
+
+/**
+ * mcp342xGetList() - latest values of a list of logical channels in one call
+ * @return	number of entries holding a valid sample, or error code
+ * @note	Consecutive entries on the same device form one consistent snapshot
+ */
+int	mcp342xGetList(const u8_t * pu8Ch, int Count, mcp342x_val_t * psOut) {
+	return mcp342xGetVals(pu8Ch, 0, Count, psOut);
+}
+
+/**
+ * mcp342xSampleVolts() - scale a stored code to Volts using the config it was converted at
+ */
+double mcp342xSampleVolts(const mcp342x_smp_t * psSmp) { return (double) psSmp->Code * mcp342xLSB(psSmp->Cfg); }
+
+/**
+ * mcp342xConfigDeadline() - set the maximum acceptable sample age for a channel
+ * @param	mS - deadline in mS, 0 to remove
+ * @note	Used by the sweep planner to move channels at risk of exceeding their deadline forward
+ */
+int	mcp342xConfigDeadline(int LogCh, int mS) {
+	if (psaMCP342X == NULL) return erINV_STATE;
+	if (OUTSIDE(0, LogCh, mcp342xNumCh - 1) || OUTSIDE(0, mS, UINT16_MAX)) return erINV_PARA;
+	mcp342x_t * psMCP342X = mcp342xGetDev(LogCh);
+	xRtosSemaphoreTake(&psMCP342X->mux, portMAX_DELAY);
+	psMCP342X->sSched.DeadMs[LogCh - psMCP342X->ChLo] = mS;
+	xRtosSemaphoreGive(&psMCP342X->mux);
+	return erSUCCESS;
+}
+
+/**
+ * mcp342xConfigPrio() - mark a channel as low priority, its rate is reduced first under load
+ */
+int	mcp342xConfigPrio(int LogCh, int Low) {
+	if (psaMCP342X == NULL) return erINV_STATE;
+	if (OUTSIDE(0, LogCh, mcp342xNumCh - 1)) return erINV_PARA;
+	mcp342x_t * psMCP342X = mcp342xGetDev(LogCh);
+	u8_t Bit = 1 << (LogCh - psMCP342X->ChLo);
+	xRtosSemaphoreTake(&psMCP342X->mux, portMAX_DELAY);
+	psMCP342X->sSched.LowPri = Low ? (psMCP342X->sSched.LowPri | Bit) : (psMCP342X->sSched.LowPri & ~Bit);
+	xRtosSemaphoreGive(&psMCP342X->mux);
+	return erSUCCESS;
+}
+
+/**
+ * mcp342xConfigIdle() - what a channel does while nobody is subscribed to it
+ * @param	Idle - mcp342xIDLE_RUN (default, convert every sweep), mcp342xIDLE_KEEP or mcp342xIDLE_PAUSE
+ * @param	KeepS - IDLE_KEEP, convert only when the last sample is older than this, 1 -> 3600 seconds
+ * @note	Conversion time given up by idle channels goes to the subscribed channels on the device
+ */
+int	mcp342xConfigIdle(int LogCh, int Idle, int KeepS) {
+	if (psaMCP342X == NULL) return erINV_STATE;
+	if (OUTSIDE(0, LogCh, mcp342xNumCh - 1) || OUTSIDE(0, Idle, mcp342xIDLE_NUM - 1) ||
+		(Idle == mcp342xIDLE_KEEP && OUTSIDE(1, KeepS, 3600))) {
+		return erINV_PARA;
+	}
+	mcp342x_t * psMCP342X = mcp342xGetDev(LogCh);
+	if (psMCP342X == NULL) return erINV_STATE;
+	xRtosSemaphoreTake(&psMCP342X->mux, portMAX_DELAY);
+	saSub[LogCh].KeepS = KeepS;
+	saSub[LogCh].Idle = Idle;
+	xRtosSemaphoreGive(&psMCP342X->mux);
+	return erSUCCESS;
+}
+
+/**
+ * mcp342xSubscribe() - register interest in a channel, effective from the next sweep
+ * @param	Sub - one or more mcp342xSUB_* consumer classes
+ * @param	LeaseS - mcp342xSUB_UI only, subscription expires after this many seconds unless renewed
+ * @note	Counted per class, every call must be balanced by mcp342xUnsubscribe() unless the
+ *			UI lease is left to expire. Subscriptions survive the channel being disabled.
+ */
+int	mcp342xSubscribe(int LogCh, int Sub, int LeaseS) {
+	if (psaMCP342X == NULL) return erINV_STATE;
+	if (OUTSIDE(0, LogCh, mcp342xNumCh - 1) || OUTSIDE(1, Sub, 0x0F) || ((Sub & mcp342xSUB_UI) && LeaseS < 1)) {
+		return erINV_PARA;
+	}
+	mcp342x_t * psMCP342X = mcp342xGetDev(LogCh);
+	if (psMCP342X == NULL) return erINV_STATE;
+	mcp342x_sub_t * psSub = &saSub[LogCh];
+	int iRV = erSUCCESS;
+	xRtosSemaphoreTake(&psMCP342X->mux, portMAX_DELAY);
+	for (int i = 0; i < mcp342xSUB_NUM; ++i) {
+		if ((Sub & (1 << i)) && psSub->Cnt[i] == UINT8_MAX) {
+			iRV = erINV_STATE;							// no partial subscription
+			goto exit;
+		}
+	}
+	if (Sub & mcp342xSUB_UI) {							// extend, never cut short another UI lease
+		u32_t tLease = esp_timer_get_time() / 1000000 + LeaseS;
+		if ((psSub->Mask & mcp342xSUB_UI) == 0 || (i32_t) (tLease - psSub->tLease) > 0) psSub->tLease = tLease;
+	}
+	for (int i = 0; i < mcp342xSUB_NUM; ++i) {
+		if (Sub & (1 << i)) ++psSub->Cnt[i];
+	}
+	psSub->Mask |= Sub;
+exit:
+	xRtosSemaphoreGive(&psMCP342X->mux);
+	return iRV;
+}
+
+/**
+ * mcp342xUnsubscribe() - drop one subscriber of each class in Sub, others keep the channel running
+ */
+int	mcp342xUnsubscribe(int LogCh, int Sub) {
+	if (psaMCP342X == NULL) return erINV_STATE;
+	if (OUTSIDE(0, LogCh, mcp342xNumCh - 1) || OUTSIDE(1, Sub, 0x0F)) return erINV_PARA;
+	mcp342x_t * psMCP342X = mcp342xGetDev(LogCh);
+	if (psMCP342X == NULL) return erINV_STATE;
+	mcp342x_sub_t * psSub = &saSub[LogCh];
+	xRtosSemaphoreTake(&psMCP342X->mux, portMAX_DELAY);
+	for (int i = 0; i < mcp342xSUB_NUM; ++i) {
+		if ((Sub & (1 << i)) == 0 || psSub->Cnt[i] == 0) continue;
+		if (--psSub->Cnt[i] == 0) psSub->Mask &= ~(1 << i);
+	}
+	xRtosSemaphoreGive(&psMCP342X->mux);
+	return erSUCCESS;
+}
+
+/**
+ * mcp342xShedConfig() - configure global load shedding
+ * @param	CpuLimit - shed when CPU utilization exceeds this %, 0 to consider bus utilization only
+ * @param	MaxLevel - deepest shedding, low priority channels at 1/2^MaxLevel rate, 0 to disable
+ * @note	Bus limits are those set with mcp342xBusLimit(). CPU is the idle time of the timer
+ *			task core if FreeRTOS run time stats are enabled, else the sense processing time.
+ */
+int	mcp342xShedConfig(int CpuLimit, int MaxLevel) {
+	if (OUTSIDE(0, CpuLimit, 100) || OUTSIDE(0, MaxLevel, 7)) return erINV_PARA;
+	sShed.CpuLimit = CpuLimit;
+	sShed.MaxLevel = MaxLevel;
+	return erSUCCESS;
+}
+
+/**
+ * mcp342xConfigHDR() - configure high dynamic range mode for a channel
+ * @param	Mode - mcp342xHDR_OFF, mcp342xHDR_DUAL (alternate Lo & Hi PGA) or mcp342xHDR_AUTO
+ * @param	Lo/Hi - PGA values used in DUAL mode, typically mcp342xG1 & mcp342xG8
+ * @note	Gain corrections learnt are retained while the channel stays configured.
+ *			A new block is built and swapped in, the old one retired through the timer task,
+ *			so a merge in progress never sees a half updated block.
+ */
+int	mcp342xConfigHDR(int LogCh, int Mode, int Lo, int Hi) {
+	if (psaMCP342X == NULL) return erINV_STATE;
+	if (OUTSIDE(0, LogCh, mcp342xNumCh - 1) || OUTSIDE(mcp342xHDR_OFF, Mode, mcp342xHDR_AUTO) ||
+		OUTSIDE(mcp342xG1, Lo, mcp342xG8) || OUTSIDE(mcp342xG1, Hi, mcp342xG8) || (Mode == mcp342xHDR_DUAL && Lo >= Hi)) {
+		return erINV_PARA;
+	}
+	if (psaHDR[LogCh] == NULL && Mode == mcp342xHDR_OFF) return erSUCCESS;
+	mcp342x_hdr_t * psH = pvRtosMalloc(sizeof(mcp342x_hdr_t));
+	if (psH == NULL) return erNO_MEM;
+	// take the old block out of use first, then a concurrent release can't retire it under us
+	xRtosSemaphoreTake(&mcp342xHdrMux, portMAX_DELAY);
+	mcp342x_hdr_t * psOld = __atomic_exchange_n(&psaHDR[LogCh], NULL, __ATOMIC_ACQ_REL);
+	if (psOld) {
+		*psH = *psOld;
+	} else {
+		memset(psH, 0, sizeof(mcp342x_hdr_t));
+		for (int g = mcp342xG1; g <= mcp342xG8; ++g) psH->Corr[g] = 1.0f;
+		psH->Next = Lo;
+	}
+	psH->Lo = Lo;
+	psH->Hi = Hi;
+	psH->Mode = Mode;
+	mcp342x_hdr_t * psGone = __atomic_exchange_n(&psaHDR[LogCh], psH, __ATOMIC_ACQ_REL);
+	xRtosSemaphoreGive(&mcp342xHdrMux);
+	mcp342xRetire(psOld);
+	mcp342xRetire(psGone);
+	return erSUCCESS;
+}
+
+// ################################## Bus utilization functions ####################################
+
+/**
+ * mcp342xBusLimit() - set the utilization alarm threshold for a bus
+ */
+int	mcp342xBusLimit(int Port, int Pct) {
+	if (OUTSIDE(0, Port, mcp342xNUM_BUS - 1) || OUTSIDE(1, Pct, 100)) return erINV_PARA;
+	saMCP342X_Bus[Port].Limit = Pct;
+	return erSUCCESS;
+}
+
+/**
+ * mcp342xBusModel() - worst case utilization of a bus with all devices sweeping back to back
+ * @return	utilization in 0.01% units
+ */
+int	mcp342xBusModel(int Port) {
+	if (OUTSIDE(0, Port, mcp342xNUM_BUS - 1)) return erINV_PARA;
+	u32_t Pct = 0;
+	for (int eDev = 0; eDev < mcp342xNumDev; ++eDev) {
+		mcp342x_t * psMCP342X = &psaMCP342X[eDev];
+		if (psMCP342X->psI2C->Port == Port) Pct += mcp342xBusDevModel(psMCP342X, psMCP342X->Chan, psMCP342X->Modes);
+	}
+	return Pct;
+}
+
+/**
+ * mcp342xBusProject() - modelled bus utilization if more fully populated devices were added
+ * @param	AddDev - number of additional devices, all channels enabled at Rate
+ * @return	utilization in 0.01% units, alarm logged if over the bus limit
+ * @note	New devices are costed using the bus speed and wait statistics of the first
+ *			device on the bus, answering "how many boards can share this port"
+ */
+int	mcp342xBusProject(int Port, int AddDev, int Rate) {
+	int iRV = mcp342xBusModel(Port);
+	if (iRV < erSUCCESS) return iRV;
+	if (AddDev < 0 || OUTSIDE(mcp342xR12_240, Rate, mcp342xR18_3_75)) return erINV_PARA;
+	mcp342x_t * psRef = NULL;
+	for (int eDev = 0; eDev < mcp342xNumDev && psRef == NULL; ++eDev) {
+		if (psaMCP342X[eDev].psI2C->Port == Port) psRef = &psaMCP342X[eDev];
+	}
+	if (psRef == NULL) return AddDev ? erINV_STATE : iRV;
+	u32_t DevPct = ((u64_t) mcp342xBusConv(psRef, Rate) * 10000) / (psRef->Cal[Rate] + mcp342xBusUs(psRef, sizeof(mcp342x_cfg_t)));
+	iRV += AddDev * DevPct;
+	if (iRV > (saMCP342X_Bus[Port].Limit * 100)) {
+		SL_WARN("MCP342X bus %d +%d dev projected %d.%02d%% > %d%%", Port, AddDev, iRV / 100, iRV % 100, saMCP342X_Bus[Port].Limit);
+	}
+	return iRV;
+}
+
 // ################### Identification, Diagnostics & Configuration functions #######################
 
 /**
  * mcp3424Identify() - device reset+register reads to ascertain exact device type
- * @return	erSUCCESS if supported device was detected, if not erFAILURE
+ * @return	erSUCCESS if supported device was detected, erINV_STATE if mcp342xMAX_DEV already found, else erFAILURE
  */
 int	mcp342xIdentify(i2c_di_t * psI2C) {
 	psI2C->Type = i2cDEV_MCP342X;
@@ -103,8 +1255,12 @@ int	mcp342xIdentify(i2c_di_t * psI2C) {
 	psI2C->Test	= 1;
 	u8_t u8Buf[4];
 	int iRV = halI2C_Queue(psI2C, i2cR_B, NULL, 0, u8Buf, sizeof(u8Buf), (i2cq_p1_t) NULL, (i2cq_p2_t) (u32_t) 0);
-	if (iRV < erSUCCESS) goto exit;
+	if (iRV < erSUCCESS) return iRV;
 	if (u8Buf[3] != 0x90) return erINV_WHOAMI;
+	if (mcp342xNumDev == mcp342xMAX_DEV) {				// all per device & channel arrays sized for this
+		SL_ERR("MCP342X max %d devices, ignored", mcp342xMAX_DEV);
+		return erINV_STATE;
+	}
 	psI2C->DevIdx = mcp342xNumDev++;
 	mcp342xNumCh += 4;						// MCP3424 specific
 	psI2C->IDok = 1;
@@ -114,6 +1270,7 @@ int	mcp342xIdentify(i2c_di_t * psI2C) {
 
 int	mcp342xConfig(i2c_di_t * psI2C) {
 	if (!psI2C->IDok) return erINV_STATE;
+	int iRV = erSUCCESS;
 
 	if (psaMCP342X == NULL) {							// 1st time here...
 		IF_myASSERT(debugPARAM, psI2C->DevIdx == 0);
@@ -122,6 +1279,13 @@ int	mcp342xConfig(i2c_di_t * psI2C) {
 		if (!psaMCP342X) return erNO_MEM;
 
 		memset(psaMCP342X, 0, mcp342xNumDev * sizeof(mcp342x_t));
+		psaMCP342X_SS = pvRtosMalloc(mcp342xNumCh * sizeof(mcp342x_smp_t));
+		if (!psaMCP342X_SS) {
+			vRtosFree(psaMCP342X);
+			psaMCP342X = NULL;
+			return erNO_MEM;
+		}
+		memset(psaMCP342X_SS, 0, mcp342xNumCh * sizeof(mcp342x_smp_t));
 		mcp342xNumCh = 0;			// reset to start counting up again....
 		IF_SYSTIMER_INIT(debugTIMING, stMCP342X, stMICROS, "MCP342X", 1, 300);
 	}
@@ -137,14 +1301,117 @@ int	mcp342xConfig(i2c_di_t * psI2C) {
 			psMCP342X->Chan[ch].CHAN = ch;
 			maskSET2B(psMCP342X->Modes, ch, mcp342xM1, u32_t);	// default mode
 		}
+		memcpy(psMCP342X->Stage, psMCP342X->Chan, sizeof(psMCP342X->Stage));
+		psMCP342X->StageModes = psMCP342X->Modes;
+		for (int Rate = mcp342xR12_240; Rate <= mcp342xR18_3_75; ++Rate) {
+			psMCP342X->Cal[Rate] = (1000000UL << (Rate << 1)) / 240;	// nominal 1 / SPS, uS
+		}
 		// Default mode is 240SPS ie. 1000 / 240 = 4.167mS
-		psMCP342X->th = xTimerCreateStatic("mcp342x", pdMS_TO_TICKS(5), pdFALSE, NULL, mcp342xTimerHdlr, &psMCP342X->ts);
+		psMCP342X->th = xTimerCreateStatic("mcp342x", pdMS_TO_TICKS(5), pdFALSE, psMCP342X, mcp342xTimerHdlr, &psMCP342X->ts);
+		#if (mcp342xHIRES_TIMER > 0)
+		const esp_timer_create_args_t sArgs = {
+			.callback = mcp342xHRTHdlr, .arg = psMCP342X, .dispatch_method = ESP_TIMER_TASK, .name = "mcp342x",
+		};
+		if (esp_timer_create(&sArgs, (esp_timer_handle_t *) &psMCP342X->hrt) != ESP_OK) {
+			psMCP342X->hrt = NULL;						// fall back to RTOS tick timer
+			SL_WARN("MCP342X dev %d using tick timer", psI2C->DevIdx);
+		}
+		#endif
 	}
 	psI2C->CFGok = 1;
-exit:
 	return iRV;
 }
 
+/**
+ * mcp342xConfigBulk() - publish a new configuration for a set of logical channels
+ * @param	psSet - array of channel configurations
+ * @param	Count - number of entries in the array
+ * @return	number of channels changed, or error code if any entry invalid or out of memory (nothing published)
+ * @note	Only channels that differ from the latest published config are changed. Each device touched
+ *			gets a new immutable descriptor, swapped in atomically, which the sense path adopts
+ *			as a unit at its next sweep boundary, so a sweep never mixes old and new configuration
+ *			and writers never wait for, or delay, a conversion. A descriptor published but not
+ *			yet adopted is simply superseded.
+ */
+int	mcp342xConfigBulk(const mcp342x_chset_t * psSet, int Count) {
+	if (psaMCP342X == NULL) return erINV_STATE;
+	for (int i = 0; i < Count; ++i) {
+		if (psSet[i].LogCh >= mcp342xNumCh) return erINV_PARA;
+	}
+	mcp342x_desc_t * psaD[mcp342xMAX_DEV] = { NULL };
+	int iRV = 0;
+	xRtosSemaphoreTake(&mcp342xCfgMux, portMAX_DELAY);
+	for (int eDev = 0; eDev < mcp342xNumDev; ++eDev) {		// build all, publish nothing yet
+		mcp342x_t * psMCP342X = &psaMCP342X[eDev];
+		mcp342x_desc_t sD = { .Modes = psMCP342X->StageModes };
+		memcpy(sD.Chan, psMCP342X->Stage, sizeof(sD.Chan));
+		int Diff = 0;
+		for (int i = 0; i < Count; ++i) {
+			if (psSet[i].LogCh < psMCP342X->ChLo || psSet[i].LogCh > psMCP342X->ChHi) continue;
+			int ch = psSet[i].LogCh - psMCP342X->ChLo;
+			mcp342x_cfg_t sCfg = sD.Chan[ch];
+			sCfg.RATE = psSet[i].RATE;
+			sCfg.PGA = psSet[i].PGA;
+			if (sCfg.Conf == sD.Chan[ch].Conf && psSet[i].Mode == mcp342xGetMode(sD.Modes, ch)) continue;
+			sD.Chan[ch] = sCfg;
+			maskSET2B(sD.Modes, ch, psSet[i].Mode, u32_t);
+			++Diff;
+		}
+		if (Diff == 0) continue;						// device untouched
+		psaD[eDev] = pvRtosMalloc(sizeof(mcp342x_desc_t));
+		if (psaD[eDev] == NULL) {
+			iRV = erNO_MEM;
+			break;
+		}
+		*psaD[eDev] = sD;
+		iRV += Diff;
+	}
+	for (int eDev = 0; eDev < mcp342xNumDev; ++eDev) {		// all or nothing
+		mcp342x_desc_t * psD = psaD[eDev];
+		if (psD == NULL) continue;
+		if (iRV < erSUCCESS) {
+			vRtosFree(psD);
+			continue;
+		}
+		mcp342x_t * psMCP342X = &psaMCP342X[eDev];
+		memcpy(psMCP342X->Stage, psD->Chan, sizeof(psMCP342X->Stage));
+		psMCP342X->StageModes = psD->Modes;
+		psD->Ver = ++psMCP342X->StageVer;
+		mcp342xBusCheck(psMCP342X);
+		// superseded descriptor may be under a peek in mcp342xStep(), free via the timer task
+		mcp342xRetire(__atomic_exchange_n(&psMCP342X->psNext, psD, __ATOMIC_ACQ_REL));
+	}
+	xRtosSemaphoreGive(&mcp342xCfgMux);
+	return iRV;
+}
+
+/**
+ * mcp342xConfigMode() - configure channel(s) mode, resolution and gain
+ * @note	mode /mcp342x idx mode resolution gain
+ *			All channels in the range are published together using mcp342xConfigBulk()
+ */
+int	mcp342xConfigMode(struct rule_t * psR, int Xcur, int Xmax) {
+	if (psaMCP342X == NULL) return erINV_STATE;
+	u8_t AI = psR->ActIdx;
+	int Mode = psR->para.x32[AI][0].i32;
+	int Res = psR->para.x32[AI][1].i32;
+	int Gain = psR->para.x32[AI][2].i32;
+	if (OUTSIDE(mcp342xM0, Mode, mcp342xM3) || OUTSIDE(12, Res, 18) || (Res & 1) ||
+		(Gain != 1 && Gain != 2 && Gain != 4 && Gain != 8) || Xmax > mcp342xNumCh || Xcur >= Xmax) {
+		return erINV_PARA;
+	}
+	mcp342x_chset_t sSet[mcp342xMAX_CH];
+	int Count = 0;
+	do {
+		sSet[Count].LogCh = Xcur;
+		sSet[Count].Mode = Mode;
+		sSet[Count].RATE = (Res - 12) >> 1;
+		sSet[Count].PGA = __builtin_ctz(Gain);
+		sSet[Count++].Spare = 0;
+	} while (++Xcur < Xmax);
+	return mcp342xConfigBulk(sSet, Count);
+}
+
 int	mcp342xReportChan(report_t * psR, u8_t Value) {
 	mcp342x_cfg_t sChCfg;
 	sChCfg.Conf = Value;
@@ -158,18 +1425,103 @@ int	mcp342xReportDev(report_t * psR, mcp342x_t * psMCP342X) {
 		iRV += wprintfx(psR, "#%d - A=0x%02X", ch, psMCP342X->psI2C->Addr);
 		iRV += mcp342xReportChan(psR, psMCP342X->Chan[ch].Conf);
 		int LogCh = psMCP342X->ChLo + ch;
-		iRV += wprintfx(psR, "  L=%d  vNorm=%f\r\n", psMCP342X->ChLo + ch, xCV_GetValueScaled(&psaMCP342X_EP[LogCh].var, NULL).f64);
+		mcp342x_smp_t * psSmp = &psaMCP342X_SS[LogCh];
+		iRV += wprintfx(psR, "  L=%d  Code=%ld  F=0x%02X  Seq=%u  Skip=%lu  Sub=0x%X/%d  vNorm=%f\r\n", LogCh, psSmp->Code,
+				psSmp->Flags, psSmp->Seq, saSeq[LogCh].Skip, saSub[LogCh].Mask, saSub[LogCh].Idle, xCV_GetValueScaled(&psaMCP342X_EP[LogCh].var, NULL).f64);
+		iRV += mcp342xReportHDR(psR, LogCh);
+		iRV += mcp342xDspReport(psR, LogCh);
+	}
+	return iRV;
+}
+
+/**
+ * mcp342xReportWait() - per strategy bus occupancy vs latency, and calibrated conversion times
+ */
+int	mcp342xReportWait(report_t * psR, mcp342x_t * psMCP342X) {
+	const char * const caWait[mcp342xWAIT_NUM] = { "Timer", "Poll", "Hybrid" };
+	int iRV = wprintfx(psR, "  Wait=%s  Timer=%s  QFull=%lu  Cal(uS)=%lu/%lu/%lu/%lu  Cfg=v%u/v%u\r\n", caWait[psMCP342X->Wait],
+			psMCP342X->hrt ? "uS" : "tick", saQFull[psMCP342X - psaMCP342X], psMCP342X->Cal[0], psMCP342X->Cal[1], psMCP342X->Cal[2],
+			psMCP342X->Cal[3], psMCP342X->Ver, psMCP342X->StageVer);
+	for (int Wait = 0; Wait < mcp342xWAIT_NUM; ++Wait) {
+		mcp342x_wstat_t * psWS = &psMCP342X->sWS[Wait];
+		if (psWS->Conv == 0) continue;
+		iRV += wprintfx(psR, "  %-6s Conv=%lu  Rd/Cv=%.2f  Bus/Cv=%luuS  Lat/Cv=%luuS\r\n", caWait[Wait], psWS->Conv,
+				(double) psWS->Reads / (double) psWS->Conv, (u32_t) (psWS->BusUs / psWS->Conv), (u32_t) (psWS->LatUs / psWS->Conv));
+	}
+	return iRV;
+}
+
+/**
+ * mcp342xReportSched() - sweep planner results, effective vs naive (write + wait every channel) rate
+ */
+int	mcp342xReportSched(report_t * psR, mcp342x_t * psMCP342X) {
+	mcp342x_sched_t * psS = &psMCP342X->sSched;
+	if (psS->Sweeps == 0 || psS->SweepUs == 0) return 0;
+	double dSPS = (double) psS->Conv * 1e6 / (double) psS->SweepUs;
+	double dNaive = (double) psS->Conv * 1e6 / (double) psS->NaiveUs;
+	return wprintfx(psR, "  Sweeps=%lu  Conv=%lu  Wr=%lu  Saved=%lu  Miss=%lu  Shed=%lu  Idle=%lu  SPS=%.2f  Naive=%.2f  Gain=%+.1f%%\r\n",
+			psS->Sweeps, psS->Conv, psS->Writes, psS->Saved, psS->Miss, psS->Shed, psS->Idle, dSPS, dNaive, (dSPS / dNaive - 1.0) * 100.0);
+}
+
+/**
+ * mcp342xReportHDR() - HDR state of a channel, copied so it can't be retired or change while printed
+ * @note	The seqlock wait happens before the mux is taken, the timer task is never held up by it
+ */
+int	mcp342xReportHDR(report_t * psR, int LogCh) {
+	if (psaMCP342X == NULL || OUTSIDE(0, LogCh, mcp342xNumCh - 1)) return 0;
+	mcp342x_hdr_t sH;
+	u32_t Seq;
+	do {
+		Seq = mcp342xSnapBegin(LogCh);
+		xRtosSemaphoreTake(&mcp342xHdrMux, portMAX_DELAY);
+		mcp342x_hdr_t * psH = psaHDR[LogCh];
+		if (psH) sH = *psH;
+		xRtosSemaphoreGive(&mcp342xHdrMux);
+		if (psH == NULL) return 0;
+	} while (mcp342xSnapRetry(LogCh, Seq));
+	if (sH.Mode == mcp342xHDR_OFF) return 0;
+	return wprintfx(psR, "  L=%d  HDR=%s  Lo=%d  Hi=%d  Corr=%.4f/%.4f/%.4f/%.4f\r\n", LogCh,
+			sH.Mode == mcp342xHDR_DUAL ? "Dual" : "Auto", 1 << sH.Lo, 1 << sH.Hi,
+			sH.Corr[0], sH.Corr[1], sH.Corr[2], sH.Corr[3]);
+}
+
+int	mcp342xReportBus(report_t * psR) {
+	int iRV = 0;
+	for (int Port = 0; Port < mcp342xNUM_BUS; ++Port) {
+		mcp342x_bus_t * psBus = &saMCP342X_Bus[Port];
+		if (psBus->tWin == 0) continue;					// no MCP342X traffic on this bus
+		mcp342xBusRoll(Port, psBus, mcp342xTIME_US());
+		u32_t Avg = psBus->SpanUs ? (psBus->BusyUs * 10000) / psBus->SpanUs : 0;
+		u32_t Model = mcp342xBusModel(Port);
+		iRV += wprintfx(psR, "Bus=%d  Now=%d.%02d%%  Avg=%lu.%02lu%%  Peak=%d.%02d%% @%lus  Model=%lu.%02lu%%  Limit=%d%%%s%s\r\n", Port,
+				psBus->PctNow / 100, psBus->PctNow % 100, Avg / 100, Avg % 100, psBus->PctPeak / 100, psBus->PctPeak % 100,
+				psBus->tPeak, Model / 100, Model % 100, psBus->Limit, psBus->Alarm ? "  ALARM" : "", psBus->Warn ? "  WARN" : "");
 	}
 	return iRV;
 }
 
+int	mcp342xReportShed(report_t * psR) {
+	if (sShed.tWin == 0) return 0;
+	return wprintfx(psR, "Shed  Lvl=%d/%d  CPU=%d.%02d%%  Peak=%d.%02d%%  Limit=%d%%  Up=%lu  Down=%lu\r\n", sShed.Level,
+			sShed.MaxLevel, sShed.CpuPct / 100, sShed.CpuPct % 100, sShed.CpuPeak / 100, sShed.CpuPeak % 100,
+			sShed.CpuLimit, sShed.Raised, sShed.Lowered);
+}
+
 int	mcp342xReportAll(report_t * psR) {
 	int iRV = 0;
 	for (int eCh = 0; eCh < mcp342xNumDev; ++eCh) {
 		mcp342x_t * psMCP342X = &psaMCP342X[eCh];
 		iRV += mcp342xReportDev(psR, psMCP342X);
+		iRV += mcp342xReportWait(psR, psMCP342X);
+		iRV += mcp342xReportSched(psR, psMCP342X);
 		iRV += xRtosReportTimer(psR, psMCP342X->th);
 	}
+	iRV += mcp342xReportBus(psR);
+	iRV += mcp342xReportShed(psR);
+	iRV += mcp342xEnergyReport(psR);
+	iRV += mcp342xLogReport(psR);
+	iRV += mcp342xFrameReport(psR);
+	iRV += mcp342xModbusReport(psR);
 	return iRV;
 }
 
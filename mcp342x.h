@@ -14,6 +14,11 @@ extern "C" {
 #define	mcp3423NUM_CHAN				2
 #define	mcp3424NUM_CHAN				4
 
+#define	mcp342xMAX_DEV				8					// 3 address bits
+#define	mcp342xMAX_CH				(mcp342xMAX_DEV * mcp3424NUM_CHAN)
+#define	mcp342xNUM_BUS				2					// I2C ports
+#define	mcp342xSNAP_SPIN			64					// seqlock polls while a write is open before sleeping
+
 // ######################################## Enumerations ###########################################
 
 enum {													// I2C addresses options
@@ -36,9 +41,39 @@ enum { mcp342xR0, mcp342xR1, mcp342xR2, mcp342xCFG };	// Read Data & Config Inde
 //		Disabled	Volts		mAmps	Ohms
 enum { mcp342xM0, mcp342xM1, mcp342xM2, mcp342xM3 };
 
+enum {													// Sample store flags
+	mcp342xSF_VALID	= (1 << 0),							// at least one conversion stored
+	mcp342xSF_STALE	= (1 << 1),							// last conversion failed, Code is older
+	mcp342xSF_CLIP	= (1 << 2),							// Code at positive or negative full scale
+	mcp342xSF_HDR	= (1 << 3),							// Code merged & gain corrected by HDR mode
+};
+
+// High dynamic range: off | alternate between 2 gains | auto range
+enum { mcp342xHDR_OFF, mcp342xHDR_DUAL, mcp342xHDR_AUTO };
+
+// Channel consumers, any active subscription keeps a channel at full rate.
+// Each class counts its subscribers, a class is active until all of them have unsubscribed.
+enum {
+	mcp342xSUB_RULE	= (1 << 0),
+	mcp342xSUB_LOG	= (1 << 1),
+	mcp342xSUB_UI	= (1 << 2),							// lease based, expires unless renewed
+	mcp342xSUB_APP	= (1 << 3),
+};
+#define	mcp342xSUB_NUM				4					// consumer classes
+
+// Channel without subscribers: converted as usual | only to keep its value fresh | not converted
+enum { mcp342xIDLE_RUN, mcp342xIDLE_KEEP, mcp342xIDLE_PAUSE, mcp342xIDLE_NUM };
+
+// Conversion wait: single timer | fixed interval nRDY polling | timer to near deadline then poll
+enum { mcp342xWAIT_TIMER, mcp342xWAIT_POLL, mcp342xWAIT_HYBRID, mcp342xWAIT_NUM };
+
+// Samples missing between 2 consecutive sequence numbers of a channel
+#define	mcp342xSEQ_GAP(Prev, Now)	((u16_t) ((Now) - (Prev) - 1))
+
 // ######################################### Structures ############################################
 
 struct i2c_di_t;
+struct mcp342x_burst_t;
 
 typedef union mcp342x_cfg_t {
 	struct __attribute__((packed)) {
@@ -52,40 +87,211 @@ typedef union mcp342x_cfg_t {
 } mcp342x_cfg_t;
 DUMB_STATIC_ASSERT(sizeof(mcp342x_cfg_t) == 1);
 
+typedef struct mcp342x_wstat_t {
+	u32_t Conv;									// conversions completed
+	u32_t Reads;								// result/nRDY reads issued
+	u64_t BusUs;								// estimated bus occupancy, uS
+	u64_t LatUs;								// conversion start to result read, uS
+} mcp342x_wstat_t;
+
+typedef struct mcp342x_bus_t {
+	u32_t tWin;									// current window start, uS
+	u32_t WinUs;								// busy time in current window, uS
+	u64_t BusyUs;								// total busy time, uS
+	u64_t SpanUs;								// total time accounted, uS
+	u32_t tPeak;								// start of peak window, seconds since boot
+	u16_t PctNow;								// last completed window, 0.01%
+	u16_t PctPeak;								// highest window, 0.01%
+	u8_t Limit;									// alarm threshold, %
+	u8_t Alarm:1;								// measured utilization over Limit
+	u8_t Warn:1;								// modelled utilization over Limit
+} mcp342x_bus_t;
+
+typedef struct mcp342x_shed_t {				// global load shedding
+	u32_t tWin;									// current window start, uS
+	u32_t WinUs;								// sense processing time in current window, uS
+	u32_t Idle;									// idle task run time at window start
+	u16_t CpuPct;								// last completed window, 0.01%
+	u16_t CpuPeak;								// highest window, 0.01%
+	u8_t CpuLimit;								// shed above this %, 0 = CPU not considered
+	u8_t Level;									// low priority channels converted 1 in 2^Level sweeps
+	u8_t MaxLevel;								// 0 = shedding disabled
+	u8_t Calm;									// consecutive windows below limits
+	u32_t Raised, Lowered;						// level changes
+} mcp342x_shed_t;
+
+typedef struct mcp342x_sched_t {
+	u8_t Order[4];								// channel conversion order, current sweep
+	u16_t DeadMs[4];							// per channel maximum sample age, 0 = none
+	mcp342x_cfg_t DevCfg;						// config last written to device, 0 = unknown
+	u8_t NumOrd;								// channels in Order[]
+	u8_t SwIdx;									// index into Order[] converting now
+	u8_t LowPri;								// bit per channel, rate reduced while shedding load
+	u32_t tSweep;								// sweep start, uS
+	u32_t PlanUs;								// naive time of the sweep in progress, uS
+	u32_t Sweeps;								// sweeps completed
+	u32_t Conv;									// conversions stored
+	u32_t Writes;								// config writes issued
+	u32_t Saved;								// config writes avoided
+	u32_t Miss;									// deadlines predicted missed at plan time
+	u32_t Shed;									// low priority conversions skipped to shed load
+	u32_t Idle;									// conversions skipped, channel without subscribers
+	u64_t SweepUs;								// total sweep time, uS
+	u64_t NaiveUs;								// same sweeps, write + wait every channel in order, uS
+} mcp342x_sched_t;
+
+typedef struct mcp342x_desc_t {				// published channel config, immutable once swapped in
+	mcp342x_cfg_t Chan[4];
+	u32_t Modes;
+	u16_t Ver;
+	u16_t Spare;
+} mcp342x_desc_t;
+
 typedef struct {
 	struct i2c_di_t * psI2C;
 	SemaphoreHandle_t mux;
 	TimerHandle_t th;
 	StaticTimer_t ts;
+	void * hrt;									// esp_timer_handle_t, NULL = RTOS tick timer
 	struct __attribute__((packed)) {
 		u8_t I2Cnum:4;				// index into I2C Device Info table
-		u8_t ChLo:4;
-		u8_t ChHi:4;
+		u8_t ChLo:5;
+		u8_t ChHi:5;
 		u8_t NumCh:3;				// 1, 2 or 4
-		u32_t Spare:17;
+		u8_t Busy:1;				// sweep in progress
+		u8_t ChNow:2;				// channel currently converting
+		u8_t Retry:4;				// nRDY re-read count
+		u8_t BurstAct:1;			// burst in progress, sweeps suspended
+		u8_t Wait:2;				// mcp342xWAIT_TIMER -> mcp342xWAIT_HYBRID
+		u8_t NoCal:1;				// conversion start time unknown, skip calibration
+		u8_t Dirty:4;				// channels stored this sweep, endpoints not yet updated
 	};
-	mcp342x_cfg_t Chan[4];
+	mcp342x_cfg_t Chan[4];						// live config, sense path only
 	u32_t Modes;								// 16 x 2-bit flags, 2 per channel
+	mcp342x_cfg_t Stage[4];						// writers copy of latest published Chan[]
+	u32_t StageModes;							// writers copy of latest published Modes
+	u16_t Ver;									// version of live config
+	u16_t StageVer;								// version of latest published config
+	mcp342x_desc_t * volatile psNext;			// published, not yet adopted, swapped atomically
+	volatile u32_t SSeq;						// sample store entries of device, odd while updating
+	struct mcp342x_burst_t * psBurst;			// pending or active burst
+	u32_t tStart;								// conversion start, uS
+	u32_t tNotRdy;								// last read with nRDY still set, 0 if none
+	u32_t Cal[4];								// calibrated conversion time per RATE, uS
+	mcp342x_wstat_t sWS[mcp342xWAIT_NUM];		// statistics per wait strategy
+	mcp342x_sched_t sSched;						// sweep order & statistics
 } mcp342x_t;
-DUMB_STATIC_ASSERT(sizeof(mcp342x_t) == (sizeof(void *) + sizeof(SemaphoreHandle_t) + 60));
+DUMB_STATIC_ASSERT(sizeof(mcp342x_t) == (4 * sizeof(void *) + sizeof(SemaphoreHandle_t) + 244));
+
+typedef struct mcp342x_smp_t {					// compact per channel sample store entry
+	i32_t Code;									// signed conversion code
+	u32_t Time;									// result read, uS (wraps ~71 minutes)
+	mcp342x_cfg_t Cfg;							// RATE & PGA Code was converted at
+	u8_t Flags;									// mcp342xSF_*
+	u16_t Seq;									// per channel conversion sequence, wraps
+} mcp342x_smp_t;
+DUMB_STATIC_ASSERT(sizeof(mcp342x_smp_t) == 12);
+
+typedef struct mcp342x_val_t {					// bulk getter result, 1 per channel requested
+	double Volts;								// scaled at the config converted, before endpoint scaling
+	u32_t Time;									// result read, uS
+	u16_t Seq;									// per channel conversion sequence
+	u8_t Flags;									// mcp342xSF_*, 0 = not converted since enabled
+	u8_t LogCh;
+} mcp342x_val_t;
+
+typedef struct mcp342x_seq_t {					// per channel sequence source
+	u16_t Next;									// assigned to the next conversion
+	u16_t Spare;
+	u32_t Skip;									// conversions failed, numbers consumed without a sample
+} mcp342x_seq_t;
+
+typedef struct mcp342x_sub_t {					// per channel demand
+	u8_t Mask;									// mcp342xSUB_* active, Cnt[] non zero
+	u8_t Idle;									// mcp342xIDLE_* policy
+	u16_t KeepS;								// IDLE_KEEP, max sample age, seconds
+	u32_t tLease;								// SUB_UI lease expiry, latest of all, seconds since boot
+	u8_t Cnt[mcp342xSUB_NUM];					// subscribers per class
+} mcp342x_sub_t;
+
+typedef struct mcp342x_hdr_t {
+	float Corr[4];								// actual / nominal gain per PGA, relative to G1
+	i32_t Code[4];								// last code converted at each PGA
+	u32_t Sweep[4];								// sweep number of Code[] per PGA
+	u8_t Mode;									// mcp342xHDR_*
+	u8_t Lo;									// DUAL mode low gain PGA
+	u8_t Hi;									// DUAL mode high gain PGA
+	u8_t Next;									// PGA for next conversion
+	u8_t Rate;									// RATE of Code[], change discards readings
+} mcp342x_hdr_t;
+
+typedef struct __attribute__((packed)) mcp342x_chset_t {
+	u8_t LogCh;					// logical channel
+	u8_t Mode:2;				// mcp342xM0 -> mcp342xM3
+	u8_t RATE:2;				// mcp342xR12_240 -> mcp342xR18_3_75
+	u8_t PGA:2;					// mcp342xG1 -> mcp342xG8
+	u8_t Spare:2;
+} mcp342x_chset_t;
+DUMB_STATIC_ASSERT(sizeof(mcp342x_chset_t) == 2);
+
+typedef void (* mcp342x_burst_cb_t)(struct mcp342x_burst_t *);
+
+typedef struct mcp342x_burst_t {
+	i32_t * pi32Buf;							// caller supplied, Count entries
+	mcp342x_burst_cb_t cb;						// called (timer task) when burst ends
+	u16_t Count;								// samples requested
+	u16_t Done;									// samples stored
+	u16_t Polls;								// reads issued, Polls - Done = not ready
+	u8_t LogCh;
+	u8_t RATE:2;								// mcp342xR12_240 -> mcp342xR18_3_75
+	u8_t PGA:2;									// mcp342xG1 -> mcp342xG8
+	u8_t Abort:1;								// ended early, nRDY timeout or I2C error
+	u8_t Spare:3;
+} mcp342x_burst_t;
 
 // ##################################### Global variables ##########################################
 
 extern mcp342x_t *	psaMCP342X;
 extern epw_t *	psaMCP342X_EP;
-extern mcp342xNumDev, mcp342xNumCh;
+extern mcp342x_smp_t * psaMCP342X_SS;
+extern u8_t mcp342xNumDev, mcp342xNumCh;
 
 // ####################################### Public functions ########################################
 
 struct epw_t;
 int	mcp342xSense(struct epw_t *);
+void mcp342xRetire(void * pvMem);
 struct rule_t;
 int mcp342xConfigMode(struct rule_t * psR, int Xcur, int Xmax);
 int	mcp342xIdentify(struct i2c_di_t * psI2C);
 int	mcp342xConfig(struct i2c_di_t * psI2C);
+int	mcp342xConfigBulk(const mcp342x_chset_t * psSet, int Count);
+int	mcp342xBurst(mcp342x_burst_t * psBurst);
+int	mcp342xConfigWait(int eDev, int Wait);
+int	mcp342xConfigDeadline(int LogCh, int mS);
+int	mcp342xConfigHDR(int LogCh, int Mode, int Lo, int Hi);
+int	mcp342xConfigPrio(int LogCh, int Low);
+int	mcp342xConfigIdle(int LogCh, int Idle, int KeepS);
+int	mcp342xSubscribe(int LogCh, int Sub, int LeaseS);
+int	mcp342xUnsubscribe(int LogCh, int Sub);
+int	mcp342xShedConfig(int CpuLimit, int MaxLevel);
+int	mcp342xGetSample(int LogCh, mcp342x_smp_t * psSmp);
+u32_t mcp342xSnapBegin(int LogCh);
+int	mcp342xSnapRetry(int LogCh, u32_t Seq);
+int	mcp342xGetRange(int LogCh, int Count, mcp342x_val_t * psOut);
+int	mcp342xGetList(const u8_t * pu8Ch, int Count, mcp342x_val_t * psOut);
+double mcp342xSampleVolts(const mcp342x_smp_t * psSmp);
+int	mcp342xBusLimit(int Port, int Pct);
+int	mcp342xBusModel(int Port);
+int	mcp342xBusProject(int Port, int AddDev, int Rate);
 struct report_t;
 int	mcp342xReportChan(struct report_t * psR, u8_t eCh);
 int	mcp342xReportDev(struct report_t * psR, mcp342x_t *);
+int	mcp342xReportWait(struct report_t * psR, mcp342x_t *);
+int	mcp342xReportSched(struct report_t * psR, mcp342x_t *);
+int	mcp342xReportHDR(struct report_t * psR, int LogCh);
+int	mcp342xReportShed(struct report_t * psR);
+int	mcp342xReportBus(struct report_t * psR);
 int	mcp342xReportAll(struct report_t * psR);
 
 #ifdef __cplusplus
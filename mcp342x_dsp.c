@@ -0,0 +1,892 @@
+//mcp342x_dsp.c - Copyright (c) 2021-24 Andre M. Maree / KSS Technologies (Pty) Ltd.
+
+#include "hal_platform.h"
+
+#if (HAL_MCP342X > 0)
+#include "endpoints.h"
+#include "mcp342x_dsp.h"
+#include "printfx.h"
+#include "syslog.h"
+#include "errors_events.h"
+
+#include "esp_timer.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define	debugFLAG					0xF000
+
+#define	debugTIMING					(debugFLAG_GLOBAL & debugFLAG & 0x1000)
+#define	debugTRACK					(debugFLAG_GLOBAL & debugFLAG & 0x2000)
+#define	debugPARAM					(debugFLAG_GLOBAL & debugFLAG & 0x4000)
+#define	debugRESULT					(debugFLAG_GLOBAL & debugFLAG & 0x8000)
+
+// ##################################### Developer notes ###########################################
+
+/* Derived values are computed incrementally from each sample stored by the conversion path
+ * (sweeps and bursts), always in the RTOS timer task. All accumulation is done on raw codes
+ * in fixed point, scaling to Volts only happens when a value is read.
+ * State is allocated per channel, per function, only when enabled. It is never changed in place
+ * by config calls, a new block is built and swapped in and the old one retired.
+ * Readers copy what they need with DspMux held, which keeps any block from being swapped out (and
+ * so freed) meanwhile, and repeat the copy if the channel seqlock shows a feed overlapped it.
+ * Nothing is formatted or printed with the mux held.
+ * History is the exception, bins are kept in uV so that tiers remain comparable across
+ * PGA/RATE changes. Each 1s bin rolls into the open 1min bin when closed, and so on.
+ */
+
+// ######################################### Constants #############################################
+
+static const float mcp342xQSp[mcp342xQS_NUM] = { 0.50f, 0.95f, 0.99f };
+
+static const u16_t mcp342xHistLen[mcp342xHT_NUM] = { mcp342xHIST_1S, mcp342xHIST_1M, mcp342xHIST_15M };
+static const u16_t mcp342xHistOfs[mcp342xHT_NUM] = { 0, mcp342xHIST_1S, mcp342xHIST_1S + mcp342xHIST_1M };
+static const u16_t mcp342xHistSpan[mcp342xHT_NUM] = { 1, 60, 900 };	// seconds per bin
+
+// ###################################### Local variables ##########################################
+
+static mcp342x_dsp_t * psaDSP[mcp342xMAX_CH] = { NULL };
+static SemaphoreHandle_t DspMux = NULL;				// pointer swaps vs reader copies, never waited on holding
+
+enum { dspRMS, dspGZ, dspZC, dspHIST, dspQS, dspANOM };	// state blocks, see mcp342xDspPublish()
+
+// ################################ Local ONLY utility functions ###################################
+
+static u32_t mcp342xIsqrt(u64_t Val) {
+	u64_t Res = 0, Bit = 1ULL << 62;
+	while (Bit > Val) Bit >>= 2;
+	while (Bit) {
+		if (Val >= Res + Bit) {
+			Val -= Res + Bit;
+			Res = (Res >> 1) + Bit;
+		} else {
+			Res >>= 1;
+		}
+		Bit >>= 2;
+	}
+	return Res;
+}
+
+static double mcp342xDspVolts(i32_t Code, mcp342x_cfg_t sCfg) {
+	mcp342x_smp_t sSmp = { .Code = Code, .Cfg = sCfg };
+	return mcp342xSampleVolts(&sSmp);
+}
+
+/**
+ * mcp342xDspPublish() - swap in a new state block for one function, NULL to disable, retire the old
+ * @param	pvNew - fully initialised block, freed here on failure
+ * @note	Feed (timer task) only ever sees the old or the new block, never one being (re)built.
+ *			Serialised with mcp342xDspRelease() so a block is never published into released state.
+ */
+static int mcp342xDspPublish(int LogCh, int Fn, void * pvNew) {
+	mcp342x_dsp_t * psNew = NULL;
+	void * pvOld = NULL;
+	for (;;) {
+		if (pvNew && psaDSP[LogCh] == NULL && psNew == NULL) {
+			psNew = pvRtosMalloc(sizeof(mcp342x_dsp_t));
+			if (psNew == NULL) {
+				vRtosFree(pvNew);
+				return erNO_MEM;
+			}
+			memset(psNew, 0, sizeof(mcp342x_dsp_t));
+		}
+		xRtosSemaphoreTake(&DspMux, portMAX_DELAY);
+		mcp342x_dsp_t * psD = psaDSP[LogCh];
+		if (psD == NULL && pvNew) {
+			if (psNew == NULL) {						// released since checked, allocate again
+				xRtosSemaphoreGive(&DspMux);
+				continue;
+			}
+			psD = psNew;
+			psNew = NULL;
+		}
+		if (psD) {
+			switch (Fn) {
+			case dspRMS:	pvOld = __atomic_exchange_n(&psD->psRMS, (mcp342x_rms_t *) pvNew, __ATOMIC_ACQ_REL); break;
+			case dspGZ:		pvOld = __atomic_exchange_n(&psD->psGZ, (mcp342x_gz_t *) pvNew, __ATOMIC_ACQ_REL); break;
+			case dspZC:		pvOld = __atomic_exchange_n(&psD->psZC, (mcp342x_zc_t *) pvNew, __ATOMIC_ACQ_REL); break;
+			case dspHIST:	pvOld = __atomic_exchange_n(&psD->psHist, (mcp342x_hist_t *) pvNew, __ATOMIC_ACQ_REL); break;
+			case dspQS:		pvOld = __atomic_exchange_n(&psD->psQS, (mcp342x_qs_t *) pvNew, __ATOMIC_ACQ_REL); break;
+			case dspANOM:	pvOld = __atomic_exchange_n(&psD->psAnom, (mcp342x_anom_t *) pvNew, __ATOMIC_ACQ_REL); break;
+			}
+			__atomic_store_n(&psaDSP[LogCh], psD, __ATOMIC_RELEASE);
+		}
+		xRtosSemaphoreGive(&DspMux);
+		break;
+	}
+	if (psNew) vRtosFree(psNew);						// never published
+	mcp342xRetire(pvOld);
+	return erSUCCESS;
+}
+
+/**
+ * mcp342xDspLock() - pin the state of a channel for copying, no feed in progress
+ * @return	state with DspMux held, or NULL (mux not held) if nothing enabled
+ * @note	Waits for a feed to finish with the mux released. From the timer task itself (eg
+ *			an anomaly callback) no other feed can overlap, the seqlock is not checked.
+ */
+static mcp342x_dsp_t * mcp342xDspLock(int LogCh, u32_t * pSeq) {
+	int InFeed = (xTaskGetCurrentTaskHandle() == xTimerGetTimerDaemonTaskHandle());
+	for (int Spin = 0; ; ) {
+		xRtosSemaphoreTake(&DspMux, portMAX_DELAY);
+		mcp342x_dsp_t * psD = psaDSP[LogCh];
+		if (psD == NULL) break;
+		*pSeq = InFeed ? 1 : psD->Seq;					// odd = don't check
+		if (InFeed || (*pSeq & 1) == 0) {
+			__sync_synchronize();
+			return psD;
+		}
+		xRtosSemaphoreGive(&DspMux);
+		if (++Spin == mcp342xSNAP_SPIN) {
+			vTaskDelay(1);
+			Spin = 0;
+		}
+	}
+	xRtosSemaphoreGive(&DspMux);
+	return NULL;
+}
+
+/**
+ * mcp342xDspUnlock() - release state pinned by mcp342xDspLock()
+ * @return	1 if a feed overlapped the copy and it must be repeated, else 0
+ */
+static int mcp342xDspUnlock(mcp342x_dsp_t * psD, u32_t Seq) {
+	__sync_synchronize();
+	int Retry = (Seq & 1) == 0 && psD->Seq != Seq;
+	xRtosSemaphoreGive(&DspMux);
+	return Retry;
+}
+
+// ################################## RMS, peak & crest factor #####################################
+
+static void mcp342xRmsReset(mcp342x_rms_t * psR, mcp342x_cfg_t sCfg) {
+	psR->Sum = 0;
+	psR->SumSq = 0;
+	psR->Min = INT32_MAX;
+	psR->Max = INT32_MIN;
+	psR->N = 0;
+	psR->Cfg = sCfg;
+}
+
+static void mcp342xRmsFeed(mcp342x_rms_t * psR, const mcp342x_smp_t * psSmp) {
+	if (psR->N && (psSmp->Cfg.RATE != psR->Cfg.RATE || psSmp->Cfg.PGA != psR->Cfg.PGA)) {
+		mcp342xRmsReset(psR, psSmp->Cfg);				// scale changed, restart window
+	}
+	i32_t Code = psSmp->Code;
+	if (psR->N == 0) psR->Cfg = psSmp->Cfg;
+	psR->Sum += Code;
+	psR->SumSq += (i64_t) Code * Code;
+	if (Code < psR->Min) psR->Min = Code;
+	if (Code > psR->Max) psR->Max = Code;
+	if (++psR->N < psR->Win) return;
+	// window complete, publish results
+	i32_t Mean = psR->Sum / psR->N;
+	u64_t MeanSq = psR->SumSq / psR->N;
+	u64_t DcSq = (i64_t) Mean * Mean;
+	psR->Mean = Mean;
+	psR->Rms = mcp342xIsqrt(MeanSq);
+	psR->AcRms = mcp342xIsqrt(MeanSq > DcSq ? MeanSq - DcSq : 0);
+	psR->Peak = (abs(psR->Max) > abs(psR->Min)) ? abs(psR->Max) : abs(psR->Min);
+	psR->PP = psR->Max - psR->Min;
+	psR->Crest = psR->Rms ? (((u32_t) psR->Peak << 8) / psR->Rms) : 0;
+	psR->CfgR = psR->Cfg;
+	++psR->Windows;
+	mcp342xRmsReset(psR, psR->Cfg);
+}
+
+// ############################### Goertzel harmonic analysis ######################################
+
+/**
+ * mcp342xGzSetup() - compute coefficients for the sample rate, drop harmonics that alias badly
+ * @note	At 240SPS and below most mains harmonics are above Nyquist. They are still measured
+ *			at their alias frequency, valid for stationary signals, unless the alias lands within
+ *			one bin of DC, Nyquist or another harmonic's alias.
+ */
+static void mcp342xGzSetup(mcp342x_gz_t * psG, float Fs) {
+	float Fa[mcp342xGZ_NUM], Bin = Fs / (float) psG->Block;
+	psG->Fs = Fs;
+	psG->Act = 0;
+	for (int h = 0; h < mcp342xGZ_NUM; ++h) {
+		Fa[h] = fmodf((float) (psG->Fund * (h + 1)), Fs);
+		if (Fa[h] > (Fs / 2.0f)) Fa[h] = Fs - Fa[h];
+		psG->Coef[h] = 2.0f * cosf(2.0f * (float) M_PI * Fa[h] / Fs);
+		if ((psG->Mask & (1 << h)) == 0 || Fa[h] < Bin || Fa[h] > ((Fs / 2.0f) - Bin)) continue;
+		int Clash = 0;
+		for (int i = 0; i < h && Clash == 0; ++i) Clash = (psG->Act & (1 << i)) && fabsf(Fa[i] - Fa[h]) < Bin;
+		if (Clash == 0) psG->Act |= (1 << h);
+	}
+}
+
+static void mcp342xGzReset(mcp342x_gz_t * psG, mcp342x_cfg_t sCfg) {
+	memset(psG->S1, 0, sizeof(psG->S1));
+	memset(psG->S2, 0, sizeof(psG->S2));
+	psG->Sum = 0;
+	psG->N = 0;
+	psG->Cfg = sCfg;
+}
+
+static void mcp342xGzFeed(mcp342x_gz_t * psG, const mcp342x_smp_t * psSmp) {
+	if (psG->N && (psSmp->Cfg.RATE != psG->Cfg.RATE || psSmp->Cfg.PGA != psG->Cfg.PGA)) {
+		mcp342xGzReset(psG, psSmp->Cfg);
+		psG->Fs = 0.0f;									// rate changed, re-derive Fs
+	}
+	if (psG->N == 0) {
+		psG->Cfg = psSmp->Cfg;
+		psG->t0 = psSmp->Time;
+		if (psG->Fs == 0.0f) mcp342xGzSetup(psG, 240.0f / (float) (1 << (psSmp->Cfg.RATE << 1)));
+	}
+	float X = (float) psSmp->Code - psG->Dc;
+	psG->Sum += psSmp->Code;
+	for (int h = 0; h < mcp342xGZ_NUM; ++h) {
+		if ((psG->Act & (1 << h)) == 0) continue;
+		float S0 = X + (psG->Coef[h] * psG->S1[h]) - psG->S2[h];
+		psG->S2[h] = psG->S1[h];
+		psG->S1[h] = S0;
+	}
+	if (++psG->N < psG->Block) return;
+	// block complete, RMS magnitude = sqrt(2 * power) / N
+	for (int h = 0; h < mcp342xGZ_NUM; ++h) {
+		if ((psG->Act & (1 << h)) == 0) {
+			psG->Mag[h] = 0.0f;
+			continue;
+		}
+		float Pwr = (psG->S1[h] * psG->S1[h]) + (psG->S2[h] * psG->S2[h]) - (psG->Coef[h] * psG->S1[h] * psG->S2[h]);
+		psG->Mag[h] = sqrtf(2.0f * (Pwr > 0.0f ? Pwr : 0.0f)) / (float) psG->N;
+	}
+	psG->CfgR = psG->Cfg;
+	psG->Dc = (float) psG->Sum / (float) psG->N;
+	++psG->Blocks;
+	u32_t Span = psSmp->Time - psG->t0;					// track actual sample rate
+	if (Span) {
+		float Fs = (float) (psG->N - 1) * 1e6f / (float) Span;
+		if (fabsf(Fs - psG->Fs) > (psG->Fs / 200.0f)) mcp342xGzSetup(psG, Fs);
+	}
+	mcp342xGzReset(psG, psG->Cfg);
+}
+
+// ############################# Level crossing period & frequency #################################
+
+/**
+ * mcp342xZcFeed() - detect rising level crossings, interpolating the time between samples
+ * @note	Timestamps are result read times, so jitter in the conversion wait adds to the
+ *			period jitter, averaging over Avg periods reduces it.
+ */
+static void mcp342xZcFeed(mcp342x_zc_t * psZ, const mcp342x_smp_t * psSmp) {
+	if (psZ->First || psSmp->Cfg.RATE != psZ->Cfg.RATE || psSmp->Cfg.PGA != psZ->Cfg.PGA) {
+		double dLSB = mcp342xDspVolts(1, psSmp->Cfg);
+		psZ->Lv = psZ->Level / dLSB;
+		psZ->Hy = psZ->Hyst / dLSB;
+		psZ->Cfg = psSmp->Cfg;
+		psZ->Armed = psZ->Cross = psZ->First = 0;		// scale changed, restart
+		psZ->N = 0;
+		psZ->Sum = 0;
+	} else {
+		float X = (float) psSmp->Code;
+		if (X < (psZ->Lv - psZ->Hy)) {
+			psZ->Armed = 1;
+		} else if (psZ->Armed && X >= psZ->Lv && psZ->Prev < psZ->Lv) {
+			u32_t tX = psZ->tPrev + (u32_t) ((psZ->Lv - psZ->Prev) / (X - psZ->Prev) * (float) (psSmp->Time - psZ->tPrev));
+			if (psZ->Cross) {
+				psZ->Sum += tX - psZ->tCross;
+				if (++psZ->N >= psZ->Avg) {
+					psZ->Period = psZ->Sum / psZ->N;
+					psZ->Sum = 0;
+					psZ->N = 0;
+				}
+			}
+			psZ->tCross = tX;
+			psZ->Cross = 1;
+			psZ->Armed = 0;
+			++psZ->Crossings;
+		}
+	}
+	psZ->Prev = (float) psSmp->Code;
+	psZ->tPrev = psSmp->Time;
+}
+
+// ################################ P2 streaming quantiles ##########################################
+
+/**
+ * mcp342xP2Feed() - Jain & Chlamtac P2 quantile update, 5 markers, O(1) time & memory
+ * @param	N - samples fed before this one (this window)
+ */
+static void mcp342xP2Feed(mcp342x_p2_t * psM, float p, u32_t N, float x) {
+	if (N < 5) {										// collect first 5, insertion sorted
+		int i = N;
+		while (i > 0 && psM->q[i - 1] > x) { psM->q[i] = psM->q[i - 1]; --i; }
+		psM->q[i] = x;
+		if (N == 4) {
+			for (i = 0; i < 5; ++i) psM->n[i] = i;
+			psM->np[0] = 0.0f;
+			psM->np[1] = 2.0f * p;
+			psM->np[2] = 4.0f * p;
+			psM->np[3] = 2.0f + 2.0f * p;
+			psM->np[4] = 4.0f;
+		}
+		return;
+	}
+	int k;
+	if (x < psM->q[0]) {
+		psM->q[0] = x;
+		k = 0;
+	} else if (x >= psM->q[4]) {
+		psM->q[4] = x;
+		k = 3;
+	} else {
+		for (k = 0; k < 3 && x >= psM->q[k + 1]; ++k);
+	}
+	for (int i = k + 1; i < 5; ++i) ++psM->n[i];
+	psM->np[1] += p / 2.0f;
+	psM->np[2] += p;
+	psM->np[3] += (1.0f + p) / 2.0f;
+	psM->np[4] += 1.0f;
+	for (int i = 1; i < 4; ++i) {
+		float d = psM->np[i] - (float) psM->n[i];
+		if ((d >= 1.0f && psM->n[i + 1] - psM->n[i] > 1) || (d <= -1.0f && psM->n[i - 1] - psM->n[i] < -1)) {
+			int s = (d > 0.0f) ? 1 : -1;
+			float q = psM->q[i];
+			float dp = (float) (psM->n[i + 1] - psM->n[i]), dm = (float) (psM->n[i] - psM->n[i - 1]);
+			float qp = q + (float) s / (dp + dm) * (((float) s + dm) * (psM->q[i + 1] - q) / dp +
+													(dp - (float) s) * (q - psM->q[i - 1]) / dm);
+			if (psM->q[i - 1] < qp && qp < psM->q[i + 1]) {
+				psM->q[i] = qp;							// parabolic
+			} else {									// linear
+				psM->q[i] = q + (float) s * (psM->q[i + s] - q) / (float) (psM->n[i + s] - psM->n[i]);
+			}
+			psM->n[i] += s;
+		}
+	}
+}
+
+/**
+ * mcp342xQsFeed() - feed all quantile estimators, publish & restart at the end of each window
+ * @note	Volts are used so that a PGA/RATE change mid window does not corrupt the markers
+ */
+static void mcp342xQsFeed(mcp342x_qs_t * psQ, const mcp342x_smp_t * psSmp) {
+	float x = mcp342xSampleVolts(psSmp);
+	for (int i = 0; i < mcp342xQS_NUM; ++i) mcp342xP2Feed(&psQ->M[i], mcp342xQSp[i], psQ->N, x);
+	if (++psQ->N < psQ->Win) return;
+	for (int i = 0; i < mcp342xQS_NUM; ++i) psQ->Res[i] = psQ->M[i].q[2];
+	++psQ->Windows;
+	psQ->N = 0;
+}
+
+// ################################ CUSUM & EWMA anomaly detection ################################
+
+static void mcp342xAnomEvent(mcp342x_anom_t * psA, int LogCh, int Event, float Value) {
+	++psA->Events[Event];
+	if (psA->Cfg.cb) psA->Cfg.cb(LogCh, Event, Value);
+}
+
+static void mcp342xAnomLimits(mcp342x_anom_t * psA) {
+	float l = psA->Cfg.Lambda;
+	psA->Lim = psA->Cfg.L * psA->Cfg.Sigma * sqrtf(l / (2.0f - l));
+	psA->Ewma = psA->Cfg.Target;
+	psA->Hi = psA->Lo = 0.0f;
+	psA->Learnt = 1;
+}
+
+/**
+ * mcp342xAnomFeed() - tabular CUSUM (both sides) and EWMA chart, O(1) per sample
+ * @note	Target & Sigma are either supplied or learnt (Welford) from the first Learn samples,
+ *			with a Fixed Target only Sigma is learnt, as RMS deviation from that Target
+ */
+static void mcp342xAnomFeed(mcp342x_anom_t * psA, int LogCh, const mcp342x_smp_t * psSmp) {
+	float x = mcp342xSampleVolts(psSmp);
+	if (psA->Learnt == 0) {
+		++psA->N;
+		double Delta = x - psA->Cfg.Target;
+		if (psA->Cfg.Fixed) {
+			psA->M2 += Delta * Delta;
+		} else {
+			psA->Cfg.Target += Delta / psA->N;
+			psA->M2 += Delta * (x - psA->Cfg.Target);
+		}
+		if (psA->N < psA->Cfg.Learn) return;
+		psA->Cfg.Sigma = sqrt(psA->M2 / (psA->Cfg.Fixed ? psA->N : psA->N - 1));
+		if (psA->Cfg.Sigma <= 0.0f) psA->Cfg.Sigma = mcp342xDspVolts(1, psSmp->Cfg);	// noiseless, 1 LSB
+		mcp342xAnomLimits(psA);
+		psA->N = 0;
+		return;
+	}
+	++psA->N;
+	float z = (x - psA->Cfg.Target) / psA->Cfg.Sigma;
+	psA->Hi = fmaxf(0.0f, psA->Hi + z - psA->Cfg.k);
+	psA->Lo = fmaxf(0.0f, psA->Lo - z - psA->Cfg.k);
+	if (psA->Hi > psA->Cfg.h) {
+		mcp342xAnomEvent(psA, LogCh, mcp342xAE_CUSUM_HI, psA->Hi);
+		psA->Hi = 0.0f;
+	}
+	if (psA->Lo > psA->Cfg.h) {
+		mcp342xAnomEvent(psA, LogCh, mcp342xAE_CUSUM_LO, psA->Lo);
+		psA->Lo = 0.0f;
+	}
+	psA->Ewma += psA->Cfg.Lambda * (x - psA->Ewma);
+	float Dev = psA->Ewma - psA->Cfg.Target;
+	int Out = (Dev > psA->Lim) ? 1 : (Dev < -psA->Lim) ? 2 : 0;
+	if (Out != psA->Out) {								// edge triggered
+		psA->Out = Out;
+		mcp342xAnomEvent(psA, LogCh, Out == 1 ? mcp342xAE_EWMA_HI : Out == 2 ? mcp342xAE_EWMA_LO : mcp342xAE_EWMA_CLR, psA->Ewma);
+	}
+}
+
+// ################################# Multi-resolution history ######################################
+
+static void mcp342xHaccReset(mcp342x_hacc_t * psA) {
+	psA->Sum = 0;
+	psA->Min = INT32_MAX;
+	psA->Max = INT32_MIN;
+	psA->N = 0;
+}
+
+/**
+ * mcp342xHistAdvance() - close tier bins up to (not including) bin Idx, rolling each into the next tier
+ * @note	Over a gap longer than the ring only empty bins remain, these are skipped in one step
+ */
+static void mcp342xHistAdvance(mcp342x_hist_t * psH, int t, u32_t Idx) {
+	while (psH->Idx[t] < Idx) {
+		mcp342x_hacc_t * psA = &psH->Acc[t];
+		if (psA->N == 0 && (Idx - psH->Idx[t]) > mcp342xHistLen[t]) psH->Idx[t] = Idx - mcp342xHistLen[t];
+		if (t + 1 < mcp342xHT_NUM) {
+			mcp342xHistAdvance(psH, t + 1, (psH->Idx[t] * mcp342xHistSpan[t]) / mcp342xHistSpan[t + 1]);
+			mcp342x_hacc_t * psU = &psH->Acc[t + 1];
+			if (psA->N) {
+				psU->Sum += psA->Sum;
+				psU->N += psA->N;
+				if (psA->Min < psU->Min) psU->Min = psA->Min;
+				if (psA->Max > psU->Max) psU->Max = psA->Max;
+			}
+		}
+		mcp342x_hbin_t * psB = &psH->Bin[mcp342xHistOfs[t] + psH->Head[t]];
+		psB->Min = psA->Min;
+		psB->Max = psA->Max;
+		psB->Mean = psA->N ? (i32_t) (psA->Sum / psA->N) : 0;
+		psH->Head[t] = (psH->Head[t] + 1) % mcp342xHistLen[t];
+		if (psH->Cnt[t] < mcp342xHistLen[t]) ++psH->Cnt[t];
+		mcp342xHaccReset(psA);
+		++psH->Idx[t];
+	}
+}
+
+static void mcp342xHistFeed(mcp342x_hist_t * psH, const mcp342x_smp_t * psSmp) {
+	u32_t Sec = esp_timer_get_time() / 1000000;
+	if (psH->Init == 0) {
+		for (int t = 0; t < mcp342xHT_NUM; ++t) psH->Idx[t] = Sec / mcp342xHistSpan[t];
+		psH->Init = 1;
+	}
+	mcp342xHistAdvance(psH, mcp342xHT_1S, Sec);
+	i32_t uV = (i32_t) lround(mcp342xSampleVolts(psSmp) * 1e6);
+	mcp342x_hacc_t * psA = &psH->Acc[mcp342xHT_1S];
+	psA->Sum += uV;
+	++psA->N;
+	if (uV < psA->Min) psA->Min = uV;
+	if (uV > psA->Max) psA->Max = uV;
+}
+
+// ####################################### Public functions ########################################
+
+/**
+ * mcp342xDspFeed() - pass a new sample through all derived value functions enabled on the channel
+ */
+void mcp342xDspFeed(int LogCh, const mcp342x_smp_t * psSmp) {
+	mcp342x_dsp_t * psD = psaDSP[LogCh];
+	if (psD == NULL) return;
+	++psD->Seq;
+	__sync_synchronize();
+	if (psD->psRMS) mcp342xRmsFeed(psD->psRMS, psSmp);
+	if (psD->psGZ) mcp342xGzFeed(psD->psGZ, psSmp);
+	if (psD->psZC) mcp342xZcFeed(psD->psZC, psSmp);
+	if (psD->psHist) mcp342xHistFeed(psD->psHist, psSmp);
+	if (psD->psQS) mcp342xQsFeed(psD->psQS, psSmp);
+	if (psD->psAnom) mcp342xAnomFeed(psD->psAnom, LogCh, psSmp);
+	__sync_synchronize();
+	++psD->Seq;
+}
+
+/**
+ * mcp342xDspRelease() - drop all derived value state of a channel, eg when it is disabled
+ */
+void mcp342xDspRelease(int LogCh) {
+	xRtosSemaphoreTake(&DspMux, portMAX_DELAY);
+	mcp342x_dsp_t * psD = __atomic_exchange_n(&psaDSP[LogCh], NULL, __ATOMIC_ACQ_REL);	// stop feeding
+	xRtosSemaphoreGive(&DspMux);
+	if (psD == NULL) return;
+	mcp342xRetire(psD->psRMS);
+	mcp342xRetire(psD->psGZ);
+	mcp342xRetire(psD->psZC);
+	mcp342xRetire(psD->psHist);
+	mcp342xRetire(psD->psQS);
+	mcp342xRetire(psD->psAnom);
+	mcp342xRetire(psD);
+}
+
+/**
+ * mcp342xDspConfigRMS() - enable RMS, peak, peak-to-peak & crest factor over a window of samples
+ * @param	Win - samples per window, 2 -> 65535, 0 to disable
+ */
+int	mcp342xDspConfigRMS(int LogCh, int Win) {
+	if (OUTSIDE(0, LogCh, mcp342xNumCh - 1) || Win == 1 || OUTSIDE(0, Win, UINT16_MAX)) return erINV_PARA;
+	if (Win == 0) return mcp342xDspPublish(LogCh, dspRMS, NULL);
+	mcp342x_rms_t * psR = pvRtosMalloc(sizeof(mcp342x_rms_t));
+	if (psR == NULL) return erNO_MEM;
+	memset(psR, 0, sizeof(mcp342x_rms_t));
+	mcp342xRmsReset(psR, psaMCP342X_SS ? psaMCP342X_SS[LogCh].Cfg : (mcp342x_cfg_t) { .Conf = 0 });
+	psR->Win = Win;
+	return mcp342xDspPublish(LogCh, dspRMS, psR);
+}
+
+/**
+ * mcp342xDspConfigHarm() - enable Goertzel harmonic magnitudes on a continuously sampled channel
+ * @param	Fund - fundamental frequency, 50 or 60Hz
+ * @param	Mask - harmonics to compute, bit 0 = fundamental -> bit 6 = 7th
+ * @param	Block - samples per result, 8 -> 65535, 0 to disable
+ * @note	Sample rate is taken from the channel RATE initially, then measured from timestamps
+ */
+int	mcp342xDspConfigHarm(int LogCh, int Fund, int Mask, int Block) {
+	if (OUTSIDE(0, LogCh, mcp342xNumCh - 1) || (Fund != 50 && Fund != 60) || OUTSIDE(0, Mask, 0x7F) ||
+		OUTSIDE(0, Block, UINT16_MAX) || (Block && Block < 8)) {
+		return erINV_PARA;
+	}
+	if (Block == 0 || Mask == 0) return mcp342xDspPublish(LogCh, dspGZ, NULL);
+	mcp342x_gz_t * psG = pvRtosMalloc(sizeof(mcp342x_gz_t));
+	if (psG == NULL) return erNO_MEM;
+	memset(psG, 0, sizeof(mcp342x_gz_t));
+	psG->Fund = Fund;
+	psG->Mask = Mask;
+	psG->Block = Block;
+	return mcp342xDspPublish(LogCh, dspGZ, psG);
+}
+
+/**
+ * mcp342xDspConfigZC() - enable level crossing period & frequency measurement
+ * @param	Level - crossing level, Volts (0.0 for zero crossings of an AC signal)
+ * @param	Hyst - signal must fall below Level - Hyst before the next rising crossing counts
+ * @param	Avg - periods averaged per result, 1 -> 65535, 0 to disable
+ */
+int	mcp342xDspConfigZC(int LogCh, float Level, float Hyst, int Avg) {
+	if (OUTSIDE(0, LogCh, mcp342xNumCh - 1) || Hyst < 0.0f || OUTSIDE(0, Avg, UINT16_MAX)) return erINV_PARA;
+	if (Avg == 0) return mcp342xDspPublish(LogCh, dspZC, NULL);
+	mcp342x_zc_t * psZ = pvRtosMalloc(sizeof(mcp342x_zc_t));
+	if (psZ == NULL) return erNO_MEM;
+	memset(psZ, 0, sizeof(mcp342x_zc_t));
+	psZ->Level = Level;
+	psZ->Hyst = Hyst;
+	psZ->Avg = Avg;
+	psZ->First = 1;
+	return mcp342xDspPublish(LogCh, dspZC, psZ);
+}
+
+/**
+ * mcp342xDspConfigQS() - enable p50/p95/p99 estimates over a window of samples
+ * @param	Win - samples per window, 16 or more, 0 to disable
+ * @note	P2 markers are exact for the first 5 samples, then estimates. Tail quantiles need
+ *			a window of at least a few hundred samples to settle.
+ */
+int	mcp342xDspConfigQS(int LogCh, u32_t Win) {
+	if (OUTSIDE(0, LogCh, mcp342xNumCh - 1) || (Win && Win < 16)) return erINV_PARA;
+	if (Win == 0) return mcp342xDspPublish(LogCh, dspQS, NULL);
+	mcp342x_qs_t * psQ = pvRtosMalloc(sizeof(mcp342x_qs_t));
+	if (psQ == NULL) return erNO_MEM;
+	memset(psQ, 0, sizeof(mcp342x_qs_t));
+	psQ->Win = Win;
+	return mcp342xDspPublish(LogCh, dspQS, psQ);
+}
+
+/**
+ * mcp342xDspConfigHist() - enable/disable 1s/1min/15min min/mean/max history for a channel
+ * @note	Uses ~2.7KB per channel, history is lost when disabled
+ */
+int	mcp342xDspConfigHist(int LogCh, int Enable) {
+	if (OUTSIDE(0, LogCh, mcp342xNumCh - 1)) return erINV_PARA;
+	if (Enable == 0) return mcp342xDspPublish(LogCh, dspHIST, NULL);
+	u32_t Seq;
+	mcp342x_dsp_t * psD = mcp342xDspLock(LogCh, &Seq);
+	int Running = psD && psD->psHist;
+	if (psD) mcp342xDspUnlock(psD, Seq);
+	if (Running) return erSUCCESS;						// already running, keep history
+	mcp342x_hist_t * psH = pvRtosMalloc(sizeof(mcp342x_hist_t));
+	if (psH == NULL) return erNO_MEM;
+	memset(psH, 0, sizeof(mcp342x_hist_t));
+	for (int t = 0; t < mcp342xHT_NUM; ++t) mcp342xHaccReset(&psH->Acc[t]);
+	return mcp342xDspPublish(LogCh, dspHIST, psH);
+}
+
+/**
+ * mcp342xDspConfigAnom() - enable CUSUM & EWMA control chart detection on every sample
+ * @param	psCfg - parameters, zero fields take defaults, NULL to disable
+ * @note	Restarts detection (and learning if Sigma is 0) on each call, Target is kept if Fixed
+ *			or Sigma supplied, else learnt along with Sigma
+ */
+int	mcp342xDspConfigAnom(int LogCh, const mcp342x_anom_cfg_t * psCfg) {
+	if (OUTSIDE(0, LogCh, mcp342xNumCh - 1)) return erINV_PARA;
+	if (psCfg && (psCfg->Sigma < 0.0f || OUTSIDE(0.0f, psCfg->Lambda, 1.0f) || psCfg->L < 0.0f ||
+		psCfg->k < 0.0f || psCfg->h < 0.0f || psCfg->Learn == 1 || psCfg->Fixed > 1)) {
+		return erINV_PARA;
+	}
+	if (psCfg == NULL) return mcp342xDspPublish(LogCh, dspANOM, NULL);
+	mcp342x_anom_t * psA = pvRtosMalloc(sizeof(mcp342x_anom_t));
+	if (psA == NULL) return erNO_MEM;
+	memset(psA, 0, sizeof(mcp342x_anom_t));
+	psA->Cfg = *psCfg;
+	if (psA->Cfg.Lambda == 0.0f) psA->Cfg.Lambda = 0.2f;
+	if (psA->Cfg.L == 0.0f) psA->Cfg.L = 3.0f;
+	if (psA->Cfg.k == 0.0f) psA->Cfg.k = 0.5f;
+	if (psA->Cfg.h == 0.0f) psA->Cfg.h = 5.0f;
+	if (psA->Cfg.Learn == 0) psA->Cfg.Learn = 100;
+	if (psA->Cfg.Sigma > 0.0f) {
+		psA->Cfg.Fixed = 1;
+		mcp342xAnomLimits(psA);
+	} else if (psA->Cfg.Fixed == 0) {
+		psA->Cfg.Target = 0.0f;
+	}
+	return mcp342xDspPublish(LogCh, dspANOM, psA);
+}
+
+/**
+ * mcp342xHistGet() - copy the most recent closed bins of a history tier, oldest first
+ * @return	number of bins copied, or error code
+ */
+int	mcp342xHistGet(int LogCh, int Tier, int Count, mcp342x_hbin_t * psOut) {
+	if (OUTSIDE(0, LogCh, mcp342xNumCh - 1) || OUTSIDE(0, Tier, mcp342xHT_NUM - 1) || Count < 0) return erINV_PARA;
+	int Len = mcp342xHistLen[Tier], Num;
+	mcp342x_dsp_t * psD;
+	u32_t Seq;
+	do {
+		if ((psD = mcp342xDspLock(LogCh, &Seq)) == NULL) return erINV_STATE;
+		mcp342x_hist_t * psH = psD->psHist;
+		Num = psH ? ((Count > psH->Cnt[Tier]) ? psH->Cnt[Tier] : Count) : erINV_STATE;
+		int Idx = psH ? (psH->Head[Tier] + Len - Num) % Len : 0;
+		for (int i = 0; i < Num; ++i, Idx = (Idx + 1) % Len) psOut[i] = psH->Bin[mcp342xHistOfs[Tier] + Idx];
+	} while (mcp342xDspUnlock(psD, Seq));
+	return Num;
+}
+
+/**
+ * mcp342xHistSummary() - min, max & mean (of bin means) over the most recent bins of a tier
+ * @return	number of non-empty bins summarised, or error code
+ */
+int	mcp342xHistSummary(int LogCh, int Tier, int Count, mcp342x_hbin_t * psOut) {
+	mcp342x_hbin_t saBin[mcp342xHIST_15M];
+	int iRV = mcp342xHistGet(LogCh, Tier, Count > mcp342xHIST_15M ? mcp342xHIST_15M : Count, saBin);
+	if (iRV < erSUCCESS) return iRV;
+	i64_t Sum = 0;
+	int Num = 0;
+	psOut->Min = INT32_MAX;
+	psOut->Max = INT32_MIN;
+	for (int i = 0; i < iRV; ++i) {
+		if (saBin[i].Min > saBin[i].Max) continue;		// empty
+		if (saBin[i].Min < psOut->Min) psOut->Min = saBin[i].Min;
+		if (saBin[i].Max > psOut->Max) psOut->Max = saBin[i].Max;
+		Sum += saBin[i].Mean;
+		++Num;
+	}
+	psOut->Mean = Num ? (i32_t) (Sum / Num) : 0;
+	return Num;
+}
+
+/**
+ * mcp342xHistExport() - reduce the most recent bins of a tier to at most Points bins
+ * @param	Count - bins to export, clipped to bins available
+ * @return	number of bins written to psOut, or error code
+ * @note	Each output bin is the min of mins & max of maxes of its bucket, peaks are never lost.
+ *			Mean is the mean of non-empty bin means.
+ */
+int	mcp342xHistExport(int LogCh, int Tier, int Count, mcp342x_hbin_t * psOut, int Points) {
+	if (Points < 1) return erINV_PARA;
+	mcp342x_hbin_t saBin[mcp342xHIST_15M];
+	int iRV = mcp342xHistGet(LogCh, Tier, Count > mcp342xHIST_15M ? mcp342xHIST_15M : Count, saBin);
+	if (iRV <= erSUCCESS) return iRV;
+	if (Points > iRV) Points = iRV;
+	for (int p = 0; p < Points; ++p) {
+		int i0 = (p * iRV) / Points, i1 = ((p + 1) * iRV) / Points;
+		i64_t Sum = 0;
+		int Num = 0;
+		psOut[p] = (mcp342x_hbin_t) { .Min = INT32_MAX, .Max = INT32_MIN, .Mean = 0 };
+		for (int i = i0; i < i1; ++i) {
+			if (saBin[i].Min > saBin[i].Max) continue;
+			if (saBin[i].Min < psOut[p].Min) psOut[p].Min = saBin[i].Min;
+			if (saBin[i].Max > psOut[p].Max) psOut[p].Max = saBin[i].Max;
+			Sum += saBin[i].Mean;
+			++Num;
+		}
+		if (Num) psOut[p].Mean = Sum / Num;
+	}
+	return Points;
+}
+
+/**
+ * mcp342xDownsample() - min/max bucket reduction of a sample buffer (eg burst) for trending
+ * @param	Points - output samples wanted, even, 2 or more
+ * @return	number of samples written to pi32Out, or error code
+ * @note	Input is split into Points/2 buckets, each emits its min & max in the order they
+ *			occurred, so spikes survive any reduction ratio. Count <= Points copies through.
+ *			Can be done in place (pi32Out == pi32In).
+ */
+int	mcp342xDownsample(const i32_t * pi32In, int Count, i32_t * pi32Out, int Points) {
+	if (pi32In == NULL || pi32Out == NULL || Count < 0 || Points < 2 || (Points & 1)) return erINV_PARA;
+	if (Count <= Points) {
+		if (pi32Out != pi32In) memmove(pi32Out, pi32In, Count * sizeof(i32_t));
+		return Count;
+	}
+	int Buckets = Points / 2, o = 0;
+	for (int b = 0; b < Buckets; ++b) {
+		int i0 = ((i64_t) b * Count) / Buckets, i1 = ((i64_t) (b + 1) * Count) / Buckets;
+		int iMin = i0, iMax = i0;
+		for (int i = i0 + 1; i < i1; ++i) {
+			if (pi32In[i] < pi32In[iMin]) iMin = i;
+			if (pi32In[i] > pi32In[iMax]) iMax = i;
+		}
+		i32_t Min = pi32In[iMin], Max = pi32In[iMax];	// read before (in place) writes
+		pi32Out[o++] = (iMin <= iMax) ? Min : Max;
+		pi32Out[o++] = (iMin <= iMax) ? Max : Min;
+	}
+	return o;
+}
+
+/**
+ * mcp342xDspValue() - compute a derived value from pinned state, see mcp342xDspLock()
+ */
+static int mcp342xDspValue(mcp342x_dsp_t * psD, int eDV, double * pdVal) {
+	if (INRANGE(mcp342xDV_H1, eDV, mcp342xDV_THD)) {
+		mcp342x_gz_t * psG = psD->psGZ;
+		if (psG == NULL || psG->Blocks == 0) return erINV_STATE;
+		if (eDV == mcp342xDV_THD) {
+			float Sum = 0.0f;
+			for (int h = 1; h < mcp342xGZ_NUM; ++h) Sum += psG->Mag[h] * psG->Mag[h];
+			if ((psG->Act & 1) == 0 || psG->Mag[0] == 0.0f) return erINV_STATE;
+			*pdVal = sqrtf(Sum) / psG->Mag[0];
+			return erSUCCESS;
+		}
+		int h = eDV - mcp342xDV_H1;
+		if ((psG->Act & (1 << h)) == 0) return erINV_STATE;
+		*pdVal = (double) psG->Mag[h] * mcp342xDspVolts(1, psG->CfgR);
+		return erSUCCESS;
+	}
+	if (eDV == mcp342xDV_PERIOD || eDV == mcp342xDV_FREQ) {
+		mcp342x_zc_t * psZ = psD->psZC;
+		if (psZ == NULL || psZ->Period == 0) return erINV_STATE;
+		*pdVal = (eDV == mcp342xDV_PERIOD) ? (double) psZ->Period / 1e6 : 1e6 / (double) psZ->Period;
+		return erSUCCESS;
+	}
+	if (INRANGE(mcp342xDV_P50, eDV, mcp342xDV_P99)) {
+		mcp342x_qs_t * psQ = psD->psQS;
+		if (psQ == NULL || psQ->Windows == 0) return erINV_STATE;
+		*pdVal = psQ->Res[eDV - mcp342xDV_P50];
+		return erSUCCESS;
+	}
+	if (eDV == mcp342xDV_EWMA || eDV == mcp342xDV_CUSUM) {
+		mcp342x_anom_t * psA = psD->psAnom;
+		if (psA == NULL || psA->Learnt == 0) return erINV_STATE;
+		*pdVal = (eDV == mcp342xDV_EWMA) ? psA->Ewma : fmaxf(psA->Hi, psA->Lo);
+		return erSUCCESS;
+	}
+	mcp342x_rms_t * psR = psD->psRMS;
+	if (psR == NULL || psR->Windows == 0) return erINV_STATE;
+	switch (eDV) {
+	case mcp342xDV_MEAN:	*pdVal = mcp342xDspVolts(psR->Mean, psR->CfgR);	break;
+	case mcp342xDV_RMS:		*pdVal = mcp342xDspVolts(psR->Rms, psR->CfgR);	break;
+	case mcp342xDV_ACRMS:	*pdVal = mcp342xDspVolts(psR->AcRms, psR->CfgR);	break;
+	case mcp342xDV_PEAK:	*pdVal = mcp342xDspVolts(psR->Peak, psR->CfgR);	break;
+	case mcp342xDV_PP:		*pdVal = mcp342xDspVolts(psR->PP, psR->CfgR);	break;
+	case mcp342xDV_CREST:	*pdVal = (double) psR->Crest / 256.0;			break;
+	}
+	return erSUCCESS;
+}
+
+/**
+ * mcp342xDspGet() - read a derived value, scaled to Volts (crest factor & THD unscaled)
+ * @return	erSUCCESS, erINV_STATE if function not enabled or no result yet
+ * @note	All fields a value depends on come from the same feed
+ */
+int	mcp342xDspGet(int LogCh, int eDV, double * pdVal) {
+	if (OUTSIDE(0, LogCh, mcp342xNumCh - 1) || OUTSIDE(0, eDV, mcp342xDV_NUM - 1)) return erINV_PARA;
+	mcp342x_dsp_t * psD;
+	double dVal = 0.0;
+	u32_t Seq;
+	int iRV;
+	do {
+		if ((psD = mcp342xDspLock(LogCh, &Seq)) == NULL) return erINV_STATE;
+		iRV = mcp342xDspValue(psD, eDV, &dVal);
+	} while (mcp342xDspUnlock(psD, Seq));
+	if (iRV == erSUCCESS) *pdVal = dVal;
+	return iRV;
+}
+
+/**
+ * mcp342xDspReport() - derived values of a channel, state copied first then printed without the mux
+ */
+int	mcp342xDspReport(report_t * psR, int LogCh) {
+	if (OUTSIDE(0, LogCh, mcp342xNumCh - 1)) return 0;
+	struct {
+		mcp342x_rms_t sRMS;
+		mcp342x_gz_t sGZ;
+		mcp342x_zc_t sZC;
+		mcp342x_qs_t sQS;
+		mcp342x_anom_t sAnom;
+	} sC;
+	mcp342x_rms_t * psRMS;
+	mcp342x_gz_t * psG;
+	mcp342x_zc_t * psZ;
+	mcp342x_qs_t * psQ;
+	mcp342x_anom_t * psA;
+	int Hist;
+	mcp342x_dsp_t * psD;
+	u32_t Seq;
+	do {
+		if ((psD = mcp342xDspLock(LogCh, &Seq)) == NULL) return 0;
+		psRMS = psD->psRMS ? &sC.sRMS : NULL;
+		if (psRMS) sC.sRMS = *psD->psRMS;
+		psG = psD->psGZ ? &sC.sGZ : NULL;
+		if (psG) sC.sGZ = *psD->psGZ;
+		psZ = psD->psZC ? &sC.sZC : NULL;
+		if (psZ) sC.sZC = *psD->psZC;
+		psQ = psD->psQS ? &sC.sQS : NULL;
+		if (psQ) sC.sQS = *psD->psQS;
+		psA = psD->psAnom ? &sC.sAnom : NULL;
+		if (psA) sC.sAnom = *psD->psAnom;
+		Hist = psD->psHist != NULL;
+	} while (mcp342xDspUnlock(psD, Seq));
+	int iRV = 0;
+	if (psRMS && psRMS->Windows) {
+		iRV += wprintfx(psR, "  L=%d  Win=%u/%lu  Mean=%f  RMS=%f  AC=%f  Pk=%f  PP=%f  CF=%.2f\r\n", LogCh, psRMS->Win,
+				psRMS->Windows, mcp342xDspVolts(psRMS->Mean, psRMS->CfgR), mcp342xDspVolts(psRMS->Rms, psRMS->CfgR),
+				mcp342xDspVolts(psRMS->AcRms, psRMS->CfgR), mcp342xDspVolts(psRMS->Peak, psRMS->CfgR),
+				mcp342xDspVolts(psRMS->PP, psRMS->CfgR), (double) psRMS->Crest / 256.0);
+	}
+	if (psG && psG->Blocks) {
+		double dLSB = mcp342xDspVolts(1, psG->CfgR);
+		iRV += wprintfx(psR, "  L=%d  %dHz  Fs=%.2f  Act=0x%02X/0x%02X  H=", LogCh, psG->Fund, psG->Fs, psG->Act, psG->Mask);
+		for (int h = 0; h < mcp342xGZ_NUM; ++h) {
+			iRV += wprintfx(psR, (psG->Act & (1 << h)) ? "%s%f" : "%s-", h ? "/" : "", (double) psG->Mag[h] * dLSB);
+		}
+		iRV += wprintfx(psR, "\r\n");
+	}
+	if (psZ && psZ->Period) {
+		iRV += wprintfx(psR, "  L=%d  Lvl=%f  Hys=%f  Avg=%u  Cross=%lu  T=%luuS  F=%.3fHz\r\n", LogCh, psZ->Level,
+				psZ->Hyst, psZ->Avg, psZ->Crossings, psZ->Period, 1e6 / (double) psZ->Period);
+	}
+	if (psQ && psQ->Windows) {
+		iRV += wprintfx(psR, "  L=%d  Win=%lu/%lu  P50=%f  P95=%f  P99=%f\r\n", LogCh, psQ->Win, psQ->Windows,
+				psQ->Res[0], psQ->Res[1], psQ->Res[2]);
+	}
+	if (psA && psA->Learnt) {
+		iRV += wprintfx(psR, "  L=%d  Tgt=%f  Sd=%f  EWMA=%f (%c)  C+=%.2f  C-=%.2f  Ev=%lu/%lu/%lu/%lu\r\n", LogCh,
+				psA->Cfg.Target, psA->Cfg.Sigma, psA->Ewma, "-HL"[psA->Out], psA->Hi, psA->Lo,
+				psA->Events[mcp342xAE_CUSUM_HI], psA->Events[mcp342xAE_CUSUM_LO],
+				psA->Events[mcp342xAE_EWMA_HI], psA->Events[mcp342xAE_EWMA_LO]);
+	}
+	if (Hist) {
+		const char * const caTier[mcp342xHT_NUM] = { "1m", "1h", "24h" };
+		iRV += wprintfx(psR, "  L=%d  Hist(uV)", LogCh);
+		for (int t = 0; t < mcp342xHT_NUM; ++t) {
+			mcp342x_hbin_t sSum;
+			if (mcp342xHistSummary(LogCh, t, mcp342xHistLen[t], &sSum) > 0) {
+				iRV += wprintfx(psR, "  %s=%ld/%ld/%ld", caTier[t], sSum.Min, sSum.Mean, sSum.Max);
+			}
+		}
+		iRV += wprintfx(psR, "\r\n");
+	}
+	return iRV;
+}
+
+#endif
@@ -0,0 +1,197 @@
+/*
+ * mcp342x_dsp.h - Copyright (c) 2021-24 Andre M. Maree/KSS Technologies (Pty) Ltd.
+ */
+
+#pragma once
+
+#include "mcp342x.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ############################################# Macros ############################################
+
+#define	mcp342xGZ_NUM				7					// fundamental + 2nd -> 7th harmonic
+
+#define	mcp342xQS_NUM				3					// quantiles estimated: p50, p95, p99
+
+#define	mcp342xHIST_1S				60					// bins: last minute @ 1s
+#define	mcp342xHIST_1M				60					// bins: last hour @ 1min
+#define	mcp342xHIST_15M				96					// bins: last day @ 15min
+#define	mcp342xHIST_BINS			(mcp342xHIST_1S + mcp342xHIST_1M + mcp342xHIST_15M)
+
+// ######################################## Enumerations ###########################################
+
+enum {													// Derived values
+	mcp342xDV_MEAN,										// window mean
+	mcp342xDV_RMS,										// true RMS, DC included
+	mcp342xDV_ACRMS,									// RMS of AC component
+	mcp342xDV_PEAK,										// largest absolute value
+	mcp342xDV_PP,										// peak to peak
+	mcp342xDV_CREST,									// crest factor, PEAK / RMS
+	mcp342xDV_H1,										// harmonic RMS magnitude, fundamental
+	mcp342xDV_H7 = mcp342xDV_H1 + 6,					// ... 7th harmonic
+	mcp342xDV_THD,										// total harmonic distortion H2-H7, ratio
+	mcp342xDV_PERIOD,									// level crossing period, seconds
+	mcp342xDV_FREQ,										// level crossing frequency, Hz
+	mcp342xDV_P50,										// window median, P2 estimate
+	mcp342xDV_P95,										// window 95th percentile
+	mcp342xDV_P99,										// window 99th percentile
+	mcp342xDV_EWMA,										// EWMA control chart statistic, Volts
+	mcp342xDV_CUSUM,									// larger of upper/lower CUSUM, sigmas
+	mcp342xDV_NUM,
+};
+
+enum {													// Anomaly events
+	mcp342xAE_CUSUM_HI,									// upward shift, CUSUM reset after event
+	mcp342xAE_CUSUM_LO,									// downward shift
+	mcp342xAE_EWMA_HI,									// EWMA crossed upper control limit
+	mcp342xAE_EWMA_LO,									// EWMA crossed lower control limit
+	mcp342xAE_EWMA_CLR,									// EWMA back within control limits
+	mcp342xAE_NUM,
+};
+
+enum { mcp342xHT_1S, mcp342xHT_1M, mcp342xHT_15M, mcp342xHT_NUM };	// History tiers
+
+// ######################################### Structures ############################################
+
+typedef struct mcp342x_rms_t {
+	i64_t Sum;									// running sums, current window
+	u64_t SumSq;
+	i32_t Min, Max;
+	u16_t Win;									// samples per window
+	u16_t N;									// samples in current window
+	mcp342x_cfg_t Cfg;							// RATE & PGA of current window
+	mcp342x_cfg_t CfgR;							// RATE & PGA of results
+	u16_t Crest;								// last window crest factor, Q8.8
+	i32_t Mean, Rms, AcRms, Peak, PP;			// last window results, codes
+	u32_t Windows;								// windows completed
+} mcp342x_rms_t;
+
+typedef struct mcp342x_gz_t {
+	float Coef[mcp342xGZ_NUM];					// 2cos(2pi.Fa/Fs), Fa = aliased harmonic frequency
+	float S1[mcp342xGZ_NUM], S2[mcp342xGZ_NUM];	// Goertzel state, current block
+	float Mag[mcp342xGZ_NUM];					// last block RMS magnitude, codes
+	float Fs;									// sample rate used for Coef[], Hz
+	float Dc;									// previous block mean, removed from input
+	i64_t Sum;									// current block sum, for next Dc
+	u32_t t0;									// current block first sample, uS
+	u32_t Blocks;								// blocks completed
+	u16_t Block;								// samples per block
+	u16_t N;									// samples in current block
+	u8_t Fund;									// fundamental, 50 or 60Hz
+	u8_t Mask;									// harmonics requested, bit 0 = fundamental
+	u8_t Act;									// harmonics computed, aliases colliding removed
+	mcp342x_cfg_t Cfg;							// RATE & PGA of current block
+	mcp342x_cfg_t CfgR;							// RATE & PGA of Mag[]
+} mcp342x_gz_t;
+
+typedef struct mcp342x_zc_t {
+	float Level;								// crossing level, Volts
+	float Hyst;									// re-arm below Level - Hyst, Volts
+	float Lv, Hy;								// Level & Hyst in codes at Cfg
+	float Prev;									// previous sample, codes
+	u32_t tPrev;								// previous sample time, uS
+	u32_t tCross;								// last interpolated rising crossing, uS
+	u32_t Sum;									// periods accumulated, uS
+	u32_t Period;								// last averaged period, uS
+	u32_t Crossings;							// rising crossings detected
+	u16_t Avg;									// periods per result
+	u16_t N;									// periods in Sum
+	u8_t Armed:1;								// signal was below Level - Hyst
+	u8_t Cross:1;								// tCross valid
+	u8_t First:1;								// Prev & tPrev not yet valid
+	mcp342x_cfg_t Cfg;							// RATE & PGA Lv & Hy computed for
+} mcp342x_zc_t;
+
+typedef struct mcp342x_p2_t {					// P2 single quantile estimator
+	float q[5];									// marker heights, Volts
+	float np[5];								// desired marker positions
+	i32_t n[5];									// actual marker positions
+} mcp342x_p2_t;
+
+typedef struct mcp342x_qs_t {
+	mcp342x_p2_t M[mcp342xQS_NUM];				// one estimator per quantile
+	float Res[mcp342xQS_NUM];					// last window results, Volts
+	u32_t Win;									// samples per window
+	u32_t N;									// samples in current window
+	u32_t Windows;								// windows completed
+} mcp342x_qs_t;
+
+typedef void (* mcp342x_anom_cb_t)(int LogCh, int Event, float Value);
+
+typedef struct mcp342x_anom_cfg_t {
+	float Target;								// in control mean, Volts, learnt unless Fixed or Sigma supplied
+	float Sigma;								// in control std deviation, Volts, 0 to learn
+	float Lambda;								// EWMA weight, 0 -> 1, 0 = 0.2
+	float L;									// EWMA limit, sigmas, 0 = 3.0
+	float k;									// CUSUM allowance, sigmas, 0 = 0.5
+	float h;									// CUSUM decision interval, sigmas, 0 = 5.0
+	u16_t Learn;								// samples to learn Target & Sigma, 0 = 100
+	u8_t Fixed;									// 1 = Target supplied, learn Sigma only
+	mcp342x_anom_cb_t cb;						// called (timer task) on each event, can be NULL
+} mcp342x_anom_cfg_t;
+
+typedef struct mcp342x_anom_t {
+	mcp342x_anom_cfg_t Cfg;
+	float Lim;									// EWMA control limit, Volts
+	float Ewma;									// EWMA statistic, Volts
+	float Hi, Lo;								// CUSUM statistics, sigmas
+	double M2;									// learning, Welford or fixed Target sum of squares
+	u32_t N;									// samples learnt or fed
+	u32_t Events[mcp342xAE_NUM];
+	u8_t Learnt:1;								// Target & Sigma valid
+	u8_t Out:2;									// EWMA 0=in control, 1=above, 2=below
+} mcp342x_anom_t;
+
+typedef struct mcp342x_hbin_t {				// history bin, uV, empty if Min > Max
+	i32_t Min, Max, Mean;
+} mcp342x_hbin_t;
+
+typedef struct mcp342x_hacc_t {				// open (accumulating) history bin
+	i64_t Sum;
+	i32_t Min, Max;
+	u32_t N;
+} mcp342x_hacc_t;
+
+typedef struct mcp342x_hist_t {
+	mcp342x_hacc_t Acc[mcp342xHT_NUM];			// open bin per tier
+	u32_t Idx[mcp342xHT_NUM];					// open bin number per tier, seconds / tier span
+	u16_t Head[mcp342xHT_NUM];					// next ring slot per tier
+	u16_t Cnt[mcp342xHT_NUM];					// closed bins held per tier
+	u8_t Init;									// Idx[] valid
+	mcp342x_hbin_t Bin[mcp342xHIST_BINS];		// rings, 1s then 1min then 15min
+} mcp342x_hist_t;
+
+typedef struct mcp342x_dsp_t {					// per channel derived value state
+	mcp342x_rms_t * psRMS;
+	mcp342x_gz_t * psGZ;
+	mcp342x_zc_t * psZC;
+	mcp342x_hist_t * psHist;
+	mcp342x_qs_t * psQS;
+	mcp342x_anom_t * psAnom;
+	volatile u32_t Seq;							// odd while mcp342xDspFeed() updates any block
+} mcp342x_dsp_t;
+
+// ####################################### Public functions ########################################
+
+void mcp342xDspFeed(int LogCh, const mcp342x_smp_t * psSmp);
+void mcp342xDspRelease(int LogCh);
+int	mcp342xDspConfigRMS(int LogCh, int Win);
+int	mcp342xDspConfigHarm(int LogCh, int Fund, int Mask, int Block);
+int	mcp342xDspConfigZC(int LogCh, float Level, float Hyst, int Avg);
+int	mcp342xDspConfigQS(int LogCh, u32_t Win);
+int	mcp342xDspConfigHist(int LogCh, int Enable);
+int	mcp342xDspConfigAnom(int LogCh, const mcp342x_anom_cfg_t * psCfg);
+int	mcp342xHistGet(int LogCh, int Tier, int Count, mcp342x_hbin_t * psOut);
+int	mcp342xHistSummary(int LogCh, int Tier, int Count, mcp342x_hbin_t * psOut);
+int	mcp342xHistExport(int LogCh, int Tier, int Count, mcp342x_hbin_t * psOut, int Points);
+int	mcp342xDownsample(const i32_t * pi32In, int Count, i32_t * pi32Out, int Points);
+int	mcp342xDspGet(int LogCh, int eDV, double * pdVal);
+struct report_t;
+int	mcp342xDspReport(struct report_t * psR, int LogCh);
+
+#ifdef __cplusplus
+}
+#endif
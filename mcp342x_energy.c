@@ -0,0 +1,350 @@
+//mcp342x_energy.c - Copyright (c) 2021-24 Andre M. Maree / KSS Technologies (Pty) Ltd.
+
+#include "hal_platform.h"
+
+#if (HAL_MCP342X > 0)
+#include "endpoints.h"
+#include "mcp342x_energy.h"
+#include "printfx.h"
+#include "syslog.h"
+#include "errors_events.h"
+
+#include "esp_timer.h"
+#include "nvs.h"
+
+#include <math.h>
+
+#define	debugFLAG					0xF000
+
+#define	debugTIMING					(debugFLAG_GLOBAL & debugFLAG & 0x1000)
+#define	debugTRACK					(debugFLAG_GLOBAL & debugFLAG & 0x2000)
+#define	debugPARAM					(debugFLAG_GLOBAL & debugFLAG & 0x4000)
+#define	debugRESULT					(debugFLAG_GLOBAL & debugFLAG & 0x8000)
+
+// ##################################### Developer notes ###########################################
+
+/* Charge and energy are integrated (trapezoidal) in the RTOS timer task each time the current
+ * channel of an accumulator stores a sample, voltage is the latest sample of the V channel.
+ * Flash is never touched from the timer task. mcp342xEnergySync() must be called periodically
+ * from a background task (the logging task does so while running), it commits to NVS only
+ * when the commit interval has expired or the uncommitted change exceeds the loss limit, so
+ * at most min(LossWh, Power x CommitS) is lost on power failure. NVS is log structured & wear
+ * levelled, a commit appends ~4 entries (of 126 per 4K page) so page erases scale directly
+ * with the commit rate.
+ * NVS must be initialised (nvs_flash_init) by the application before mcp342xEnergyConfig().
+ */
+
+// ######################################### Constants #############################################
+
+#define	mcp342xEN_NS				"mcp342x"
+#define	mcp342xEN_KEY				"energy"
+#define	mcp342xEN_MAGIC				0x4E45				// 'EN'
+#define	mcp342xEN_ENTRIES			(1 + ((sizeof(mcp342x_ennv_t) + 31) / 32) + 1)	// hdr + data + index
+#define	mcp342xEN_PAGE_ENTRIES		126
+#define	mcp342xEN_CYCLES			100000				// flash sector erase endurance
+
+typedef struct mcp342x_ennv_t {					// NVS blob layout
+	u16_t Magic;
+	u16_t Num;
+	u32_t Commits;
+	double As[mcp342xEN_NUM], Ws[mcp342xEN_NUM];
+} mcp342x_ennv_t;
+
+typedef struct mcp342x_enset_t {				// config handed to the timer task
+	double As, Ws;								// restored totals, if Load
+	float ScaleV, ScaleA;
+	i8_t ChV, ChA;								// ChA -1 = disable
+	u8_t Load;
+} mcp342x_enset_t;
+
+// ###################################### Local variables ##########################################
+
+static mcp342x_energy_t saEN[mcp342xEN_NUM] = { 0 };
+static mcp342x_enpol_t sEnPol = {
+	.CommitS = mcp342xEN_COMMIT_S, .LossWh = mcp342xEN_LOSS_WH, .LossAh = mcp342xEN_LOSS_AH,
+};
+static nvs_handle_t sEnNVS;
+static u8_t EnNVSopen = 0;
+
+// ################################ Local ONLY utility functions ###################################
+
+static u32_t mcp342xEnSecs(void) { return esp_timer_get_time() / 1000000; }
+
+static int mcp342xEnLoad(mcp342x_ennv_t * psNV) {
+	if (EnNVSopen == 0) {
+		if (nvs_open(mcp342xEN_NS, NVS_READWRITE, &sEnNVS) != ESP_OK) return erFAILURE;
+		EnNVSopen = 1;
+	}
+	size_t Size = sizeof(mcp342x_ennv_t);
+	esp_err_t Err = nvs_get_blob(sEnNVS, mcp342xEN_KEY, psNV, &Size);
+	if (Err == ESP_OK && Size == sizeof(mcp342x_ennv_t) && psNV->Magic == mcp342xEN_MAGIC && psNV->Num == mcp342xEN_NUM) {
+		return erSUCCESS;
+	}
+	memset(psNV, 0, sizeof(mcp342x_ennv_t));			// absent or layout changed, start from 0
+	psNV->Magic = mcp342xEN_MAGIC;
+	psNV->Num = mcp342xEN_NUM;
+	return (Err == ESP_OK || Err == ESP_ERR_NVS_NOT_FOUND) ? erSUCCESS : erFAILURE;
+}
+
+/**
+ * mcp342xEnSnap() - consistent copy of live values, retried if the timer task updated meanwhile
+ * @note	Sleeps a tick if an update stays open, same as mcp342xSnapBegin()
+ */
+static void mcp342xEnSnap(mcp342x_energy_t * psE, double * pdAs, double * pdWs) {
+	u32_t Seq;
+	do {
+		for (int Spin = 0; (Seq = psE->Seq) & 1; ) {
+			if (++Spin == mcp342xSNAP_SPIN) {
+				vTaskDelay(1);
+				Spin = 0;
+			}
+		}
+		__sync_synchronize();
+		*pdAs = psE->As;
+		*pdWs = psE->Ws;
+		__sync_synchronize();
+	} while (Seq != psE->Seq);
+}
+
+static void mcp342xEnZero(void * pvPara, u32_t Idx) {	// timer task, no feed can overlap
+	mcp342x_energy_t * psE = &saEN[Idx];
+	++psE->Seq;
+	__sync_synchronize();
+	psE->As = psE->Ws = 0.0;
+	__sync_synchronize();
+	++psE->Seq;
+	psE->First = 1;
+}
+
+static void mcp342xEnApply(void * pvPara, u32_t Idx) {	// timer task, no feed can overlap
+	mcp342x_enset_t * psS = pvPara;
+	mcp342x_energy_t * psE = &saEN[Idx];
+	psE->Act = 0;
+	if (psS->Load && psE->Loaded == 0) {				// unless an earlier config already restored
+		++psE->Seq;
+		__sync_synchronize();
+		psE->As = psE->AsNV = psS->As;
+		psE->Ws = psE->WsNV = psS->Ws;
+		__sync_synchronize();
+		++psE->Seq;
+		psE->Loaded = 1;
+	}
+	if (psS->ChA >= 0) {
+		psE->As0 = psE->As;								// totals carried over, only averages restart
+		psE->Ws0 = psE->Ws;
+		psE->ScaleV = psS->ScaleV;
+		psE->ScaleA = psS->ScaleA;
+		psE->ChV = psS->ChV;
+		psE->ChA = psS->ChA;
+		psE->Gaps = 0;
+		psE->First = 1;
+		psE->Act = 1;
+	}
+	vRtosFree(psS);
+}
+
+// ####################################### Public functions ########################################
+
+/**
+ * mcp342xEnergyFeed() - integrate A & W for every accumulator using LogCh as current channel
+ * @note	Called from the conversion path (timer task) after the sample is stored
+ */
+void mcp342xEnergyFeed(int LogCh, const mcp342x_smp_t * psSmp) {
+	for (int i = 0; i < mcp342xEN_NUM; ++i) {
+		mcp342x_energy_t * psE = &saEN[i];
+		if (psE->Act == 0 || psE->ChA != LogCh) continue;
+		float I = mcp342xSampleVolts(psSmp) * psE->ScaleA;
+		mcp342x_smp_t * psV = (psE->ChV < 0) ? NULL : &psaMCP342X_SS[psE->ChV];
+		float P = (psV && (psV->Flags & mcp342xSF_VALID)) ? mcp342xSampleVolts(psV) * psE->ScaleV * I : 0.0f;
+		u32_t dT = psSmp->Time - psE->tPrev;
+		if (psE->First == 0 && dT < mcp342xEN_GAP_US) {
+			double dS = (double) dT / 1e6 / 2.0;
+			++psE->Seq;
+			__sync_synchronize();
+			psE->As += (double) (I + psE->Iprev) * dS;
+			psE->Ws += (double) (P + psE->Pprev) * dS;
+			__sync_synchronize();
+			++psE->Seq;
+		} else if (psE->First == 0) {
+			++psE->Gaps;
+		}
+		psE->Iprev = I;
+		psE->Pprev = P;
+		psE->tPrev = psSmp->Time;
+		psE->First = 0;
+	}
+}
+
+/**
+ * mcp342xEnergyConfig() - (re)assign an accumulator, restoring its persisted values on first use
+ * @param	ChV - voltage channel, -1 for charge only
+ * @param	ChA - current channel, -1 to disable the accumulator
+ * @param	ScaleV/ScaleA - multipliers from channel Volts to V and A (shunt, divider ratios)
+ * @note	Must not be called from the timer task, reads flash. Once restored the RAM totals are kept
+ *			across reconfiguration and disabling, so uncommitted energy is still committed by the next sync.
+ *			Applied by the timer task, between feeds, like mcp342xEnergyReset().
+ */
+int	mcp342xEnergyConfig(int Idx, int ChV, int ChA, float ScaleV, float ScaleA) {
+	if (OUTSIDE(0, Idx, mcp342xEN_NUM - 1) || OUTSIDE(-1, ChV, mcp342xNumCh - 1) || OUTSIDE(-1, ChA, mcp342xNumCh - 1) ||
+		(ChA >= 0 && ChA == ChV)) {
+		return erINV_PARA;
+	}
+	mcp342x_enset_t * psS = pvRtosMalloc(sizeof(mcp342x_enset_t));
+	if (psS == NULL) return erNO_MEM;
+	*psS = (mcp342x_enset_t) { .ScaleV = ScaleV, .ScaleA = ScaleA, .ChV = ChV, .ChA = ChA };
+	if (ChA >= 0 && saEN[Idx].Loaded == 0) {			// first use since boot
+		mcp342x_ennv_t sNV;
+		int iRV = mcp342xEnLoad(&sNV);
+		if (iRV < erSUCCESS) {
+			vRtosFree(psS);
+			return iRV;
+		}
+		psS->As = sNV.As[Idx];
+		psS->Ws = sNV.Ws[Idx];
+		psS->Load = 1;
+	}
+	if (xTimerPendFunctionCall(mcp342xEnApply, psS, Idx, portMAX_DELAY) != pdPASS) {
+		vRtosFree(psS);
+		return erFAILURE;
+	}
+	if (ChA >= 0 && sEnPol.tStart == 0) sEnPol.tStart = sEnPol.tCommit = mcp342xEnSecs();
+	return erSUCCESS;
+}
+
+/**
+ * mcp342xEnergyPolicy() - trade flash writes against data lost on power failure
+ * @param	CommitS - commit at least this often if anything changed, 10 -> 86400 seconds
+ * @param	LossWh/LossAh - commit as soon as the uncommitted change exceeds either, 0 = disabled
+ */
+int	mcp342xEnergyPolicy(u32_t CommitS, float LossWh, float LossAh) {
+	if (OUTSIDE(10, CommitS, 86400) || LossWh < 0.0f || LossAh < 0.0f) return erINV_PARA;
+	sEnPol.CommitS = CommitS;
+	sEnPol.LossWh = LossWh;
+	sEnPol.LossAh = LossAh;
+	return erSUCCESS;
+}
+
+/**
+ * mcp342xEnergyReset() - zero an accumulator, persisted by the next (forced) sync
+ */
+int	mcp342xEnergyReset(int Idx) {
+	if (OUTSIDE(0, Idx, mcp342xEN_NUM - 1)) return erINV_PARA;
+	if (xTimerPendFunctionCall(mcp342xEnZero, NULL, Idx, portMAX_DELAY) != pdPASS) return erFAILURE;
+	return erSUCCESS;
+}
+
+int	mcp342xEnergyGet(int Idx, double * pdWh, double * pdAh) {
+	if (OUTSIDE(0, Idx, mcp342xEN_NUM - 1)) return erINV_PARA;
+	mcp342x_energy_t * psE = &saEN[Idx];
+	if (psE->Act == 0) return erINV_STATE;
+	double As, Ws;
+	mcp342xEnSnap(psE, &As, &Ws);
+	if (pdWh) *pdWh = Ws / 3600.0;
+	if (pdAh) *pdAh = As / 3600.0;
+	return erSUCCESS;
+}
+
+/**
+ * mcp342xEnergySync() - commit accumulators to NVS if the policy requires it
+ * @param	Force - commit if anything changed, eg before a planned restart
+ * @return	1 if committed, 0 if not due, or error code
+ * @note	Call from a background task (never the timer task), every few seconds
+ */
+int	mcp342xEnergySync(int Force) {
+	double As[mcp342xEN_NUM], Ws[mcp342xEN_NUM];
+	u32_t tNow = mcp342xEnSecs();
+	int Changed = 0, Due = Force || (tNow - sEnPol.tCommit) >= sEnPol.CommitS;
+	for (int i = 0; i < mcp342xEN_NUM; ++i) {
+		mcp342x_energy_t * psE = &saEN[i];
+		As[i] = psE->AsNV;
+		Ws[i] = psE->WsNV;
+		if (psE->Loaded == 0) continue;
+		mcp342xEnSnap(psE, &As[i], &Ws[i]);
+		double dAh = fabs(As[i] - psE->AsNV) / 3600.0, dWh = fabs(Ws[i] - psE->WsNV) / 3600.0;
+		if (dAh > 0.0 || dWh > 0.0) Changed = 1;
+		if ((sEnPol.LossAh > 0.0f && dAh >= sEnPol.LossAh) || (sEnPol.LossWh > 0.0f && dWh >= sEnPol.LossWh)) Due = 1;
+	}
+	if (Changed == 0) {
+		if (Due) sEnPol.tCommit = tNow;					// nothing to save, restart interval
+		return 0;
+	}
+	if (Due == 0) return 0;
+	mcp342x_ennv_t sNV = { .Magic = mcp342xEN_MAGIC, .Num = mcp342xEN_NUM, .Commits = sEnPol.Commits + 1 };
+	memcpy(sNV.As, As, sizeof(As));
+	memcpy(sNV.Ws, Ws, sizeof(Ws));
+	if (EnNVSopen == 0) {
+		if (nvs_open(mcp342xEN_NS, NVS_READWRITE, &sEnNVS) != ESP_OK) goto fail;
+		EnNVSopen = 1;
+	}
+	u64_t tStart = esp_timer_get_time();
+	if (nvs_set_blob(sEnNVS, mcp342xEN_KEY, &sNV, sizeof(sNV)) != ESP_OK || nvs_commit(sEnNVS) != ESP_OK) goto fail;
+	u32_t tUs = esp_timer_get_time() - tStart;
+	for (int i = 0; i < mcp342xEN_NUM; ++i) {
+		saEN[i].AsNV = As[i];
+		saEN[i].WsNV = Ws[i];
+	}
+	sEnPol.tCommit = tNow;
+	++sEnPol.Commits;
+	sEnPol.Bytes += sizeof(sNV);
+	sEnPol.SumUs += tUs;
+	if (tUs > sEnPol.MaxUs) sEnPol.MaxUs = tUs;
+	return 1;
+fail:
+	if (sEnPol.Fails++ == 0) SL_ERR("MCP342X energy commit failed");
+	return erFAILURE;
+}
+
+int	mcp342xEnergyReport(report_t * psR) {
+	int iRV = 0;
+	for (int i = 0; i < mcp342xEN_NUM; ++i) {
+		mcp342x_energy_t * psE = &saEN[i];
+		if (psE->Act == 0) continue;
+		double As, Ws;
+		mcp342xEnSnap(psE, &As, &Ws);
+		iRV += wprintfx(psR, "E%d  V=%d  A=%d  Wh=%.4f  Ah=%.4f  Unsaved Wh=%.4f Ah=%.4f  Gaps=%lu\r\n", i, psE->ChV, psE->ChA,
+				Ws / 3600.0, As / 3600.0, (Ws - psE->WsNV) / 3600.0, (As - psE->AsNV) / 3600.0, psE->Gaps);
+	}
+	if (sEnPol.tStart) {
+		iRV += wprintfx(psR, "Commit %lus/%.3fWh/%.3fAh  #=%lu  B=%lu  Fail=%lu  Avg=%lluuS  Max=%luuS\r\n",
+				sEnPol.CommitS, sEnPol.LossWh, sEnPol.LossAh, sEnPol.Commits, sEnPol.Bytes, sEnPol.Fails,
+				sEnPol.Commits ? sEnPol.SumUs / sEnPol.Commits : 0ULL, sEnPol.MaxUs);
+	}
+	return iRV;
+}
+
+/**
+ * mcp342xEnergyBench() - flash wear against worst case loss, measured & for candidate intervals
+ * @note	Loss assumes the average power & current seen since the accumulators were configured.
+ *			Resetting an accumulator invalidates the average until it is configured again.
+ *			Life assumes NVS spreads erases evenly over all pages of its partition.
+ */
+int	mcp342xEnergyBench(report_t * psR) {
+	if (sEnPol.tStart == 0) return 0;
+	static const u32_t uaInt[] = { 10, 60, 300, 900, 3600, 14400 };
+	u32_t Elapsed = mcp342xEnSecs() - sEnPol.tStart;
+	if (Elapsed == 0) Elapsed = 1;
+	double W = 0.0, A = 0.0;
+	for (int i = 0; i < mcp342xEN_NUM; ++i) {
+		if (saEN[i].Act == 0) continue;
+		double As, Ws;
+		mcp342xEnSnap(&saEN[i], &As, &Ws);
+		W += fabs(Ws - saEN[i].Ws0);
+		A += fabs(As - saEN[i].As0);
+	}
+	W /= Elapsed;
+	A /= Elapsed;
+	nvs_stats_t sStats = { 0 };
+	nvs_get_stats(NULL, &sStats);
+	double Pages = (double) sStats.total_entries / mcp342xEN_PAGE_ENTRIES;
+	double EntryBudget = Pages * mcp342xEN_PAGE_ENTRIES * mcp342xEN_CYCLES;	// entries writable over life
+	int iRV = wprintfx(psR, "Bench  Avg=%.3fW %.4fA  NVS=%.0f pages  %u entries/commit  measured %.2f commits/h\r\n",
+			W, A, Pages, mcp342xEN_ENTRIES, (double) sEnPol.Commits * 3600.0 / Elapsed);
+	for (int i = 0; i < (int) (sizeof(uaInt) / sizeof(uaInt[0])); ++i) {
+		double PerYear = 365.0 * 86400.0 / uaInt[i];
+		iRV += wprintfx(psR, "  %5lus  %8.0f commits/y  life=%8.1fy  loss<=%.4fWh %.5fAh\r\n", uaInt[i], PerYear,
+				EntryBudget / (PerYear * mcp342xEN_ENTRIES), W * uaInt[i] / 3600.0, A * uaInt[i] / 3600.0);
+	}
+	return iRV;
+}
+
+#endif
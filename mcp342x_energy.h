@@ -0,0 +1,63 @@
+/*
+ * mcp342x_energy.h - Copyright (c) 2021-24 Andre M. Maree/KSS Technologies (Pty) Ltd.
+ */
+
+#pragma once
+
+#include "mcp342x.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ############################################# Macros ############################################
+
+#define	mcp342xEN_NUM				4					// accumulators
+#define	mcp342xEN_COMMIT_S			900					// default max seconds between commits
+#define	mcp342xEN_LOSS_WH			1.0f				// default max uncommitted Wh
+#define	mcp342xEN_LOSS_AH			0.1f				// default max uncommitted Ah
+#define	mcp342xEN_GAP_US			300000000UL			// samples further apart are not integrated
+
+// ######################################### Structures ############################################
+
+typedef struct mcp342x_energy_t {
+	double As, Ws;								// charge & energy, amp & watt seconds, live
+	double AsNV, WsNV;							// values last committed
+	double As0, Ws0;							// values when configured, for averages
+	float ScaleV, ScaleA;						// channel Volts -> V & A
+	float Iprev, Pprev;							// previous sample A & W
+	u32_t tPrev;								// previous sample time, uS
+	u32_t Gaps;									// intervals not integrated
+	volatile u32_t Seq;							// odd while being updated
+	i8_t ChV, ChA;								// ChV -1 = charge (Ah) only
+	u8_t Act:1;
+	u8_t First:1;								// Iprev & tPrev not yet valid
+	u8_t Loaded:1;								// As & Ws restored from NVS, RAM is master
+	u8_t Spare:5;
+} mcp342x_energy_t;
+
+typedef struct mcp342x_enpol_t {				// commit policy & statistics
+	u32_t CommitS;								// max seconds between commits
+	float LossWh, LossAh;						// max uncommitted change
+	u32_t tCommit;								// last commit, seconds since boot
+	u32_t tStart;								// statistics start, seconds since boot
+	u32_t Commits, Bytes, Fails;
+	u32_t MaxUs;								// slowest commit
+	u64_t SumUs;								// total commit time
+} mcp342x_enpol_t;
+
+// ####################################### Public functions ########################################
+
+void mcp342xEnergyFeed(int LogCh, const mcp342x_smp_t * psSmp);
+int	mcp342xEnergyConfig(int Idx, int ChV, int ChA, float ScaleV, float ScaleA);
+int	mcp342xEnergyPolicy(u32_t CommitS, float LossWh, float LossAh);
+int	mcp342xEnergyReset(int Idx);
+int	mcp342xEnergyGet(int Idx, double * pdWh, double * pdAh);
+int	mcp342xEnergySync(int Force);
+struct report_t;
+int	mcp342xEnergyReport(struct report_t * psR);
+int	mcp342xEnergyBench(struct report_t * psR);
+
+#ifdef __cplusplus
+}
+#endif
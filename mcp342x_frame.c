@@ -0,0 +1,184 @@
+//mcp342x_frame.c - Copyright (c) 2021-24 Andre M. Maree / KSS Technologies (Pty) Ltd.
+
+#include "hal_platform.h"
+
+#if (HAL_MCP342X > 0)
+#include "endpoints.h"
+#include "mcp342x_frame.h"
+#include "printfx.h"
+#include "syslog.h"
+#include "errors_events.h"
+
+#include "esp_timer.h"
+
+#define	debugFLAG					0xF000
+
+#define	debugTIMING					(debugFLAG_GLOBAL & debugFLAG & 0x1000)
+#define	debugTRACK					(debugFLAG_GLOBAL & debugFLAG & 0x2000)
+#define	debugPARAM					(debugFLAG_GLOBAL & debugFLAG & 0x4000)
+#define	debugRESULT					(debugFLAG_GLOBAL & debugFLAG & 0x8000)
+
+// ##################################### Developer notes ###########################################
+
+/* The uplink task owns the frame buffer. mcp342xFrameBuild() writes each entry straight from
+ * the sample store into that buffer under the device seqlock, so there is no intermediate copy,
+ * no formatting and no scaling; a device updating meanwhile just repeats its own entries.
+ * The timer task only calls mcp342xFrameSweep() at the end of a sweep, which wakes the uplink
+ * task if the device holds a framed channel, giving one frame per sweep. Build without Force
+ * returns 0 if no framed channel has a new sample, so spurious wakeups cost no packet.
+ */
+
+// ###################################### Local variables ##########################################
+
+static struct {
+	SemaphoreHandle_t mux;						// config vs build, never taken by the timer task
+	TaskHandle_t thNotify;						// woken at end of sweep, NULL = poll
+	u8_t Ch[mcp342xMAX_CH];						// framed channels, in frame order
+	u16_t Seq[mcp342xMAX_CH];					// sample Seq last framed, per entry
+	u8_t Count;
+	u8_t Fresh;									// config changed, next build never empty
+	u16_t FrameNo;
+	u32_t Frames, Bytes, Empty, Retries;
+} sFrame = { 0 };
+
+// ################################ Local ONLY utility functions ###################################
+
+/**
+ * mcp342xFramePack() - copy entries [First, Last] of a single device straight from the sample store
+ * @param	pu16Seq - sample Seq of each entry packed
+ * @return	1 if any entry has a sample not yet framed
+ */
+static int mcp342xFramePack(mcp342x_fent_t * psE, u16_t * pu16Seq, int First, int Last, u32_t tBase) {
+	u32_t Seq;
+	int New;
+	for (;;) {
+		Seq = mcp342xSnapBegin(sFrame.Ch[First]);
+		New = 0;
+		for (int i = First; i <= Last; ++i) {
+			mcp342x_smp_t * psSmp = &psaMCP342X_SS[sFrame.Ch[i]];
+			mcp342x_fent_t * psF = &psE[i];
+			i32_t Code = psSmp->Code;
+			psF->Code[0] = Code;
+			psF->Code[1] = Code >> 8;
+			psF->Code[2] = Code >> 16;
+			psF->Cfg = psSmp->Cfg;
+			psF->Flags = psSmp->Flags;
+			u32_t Age = (tBase - psSmp->Time) / 1000;
+			psF->AgeMs = (Age > UINT16_MAX) ? UINT16_MAX : Age;
+			pu16Seq[i] = psSmp->Seq;
+			if ((psSmp->Flags & mcp342xSF_VALID) && psSmp->Seq != sFrame.Seq[i]) New = 1;
+		}
+		if (mcp342xSnapRetry(sFrame.Ch[First], Seq) == 0) break;
+		++sFrame.Retries;
+	}
+	return New;
+}
+
+// ####################################### Public functions ########################################
+
+/**
+ * mcp342xFrameSweep() - end of sweep of the device owning ChLo..ChHi, wake the uplink task if framed
+ * @note	Timer task, never blocks
+ */
+void mcp342xFrameSweep(int ChLo, int ChHi) {
+	TaskHandle_t thNotify = sFrame.thNotify;
+	if (thNotify == NULL) return;
+	for (int i = 0; i < sFrame.Count; ++i) {
+		if (INRANGE(ChLo, sFrame.Ch[i], ChHi)) {
+			xTaskNotifyGive(thNotify);
+			return;
+		}
+	}
+}
+
+/**
+ * mcp342xFrameConfig() - set the channels packed into each frame
+ * @param	pu8Ch - logical channels in frame order, NULL or Count 0 to stop framing
+ * @param	thNotify - task notified (xTaskNotifyGive) once per sweep of a framed channel, NULL to poll
+ * @note	Framed channels are subscribed (mcp342xSUB_APP) so they stay at full rate
+ */
+int	mcp342xFrameConfig(const u8_t * pu8Ch, int Count, TaskHandle_t thNotify) {
+	if (pu8Ch == NULL) Count = 0;
+	if (OUTSIDE(0, Count, mcp342xNumCh)) return erINV_PARA;
+	for (int i = 0; i < Count; ++i) {
+		if (pu8Ch[i] >= mcp342xNumCh) return erINV_PARA;
+	}
+	xRtosSemaphoreTake(&sFrame.mux, portMAX_DELAY);
+	for (int i = 0; i < sFrame.Count; ++i) mcp342xUnsubscribe(sFrame.Ch[i], mcp342xSUB_APP);
+	sFrame.thNotify = NULL;
+	sFrame.Count = Count;
+	sFrame.Fresh = 1;
+	for (int i = 0; i < Count; ++i) {
+		sFrame.Ch[i] = pu8Ch[i];
+		sFrame.Seq[i] = 0;
+		mcp342xSubscribe(pu8Ch[i], mcp342xSUB_APP, 0);
+	}
+	sFrame.thNotify = Count ? thNotify : NULL;
+	xRtosSemaphoreGive(&sFrame.mux);
+	return erSUCCESS;
+}
+
+/**
+ * mcp342xFrameBuild() - pack the configured channels into a frame
+ * @param	pu8Buf - destination, at least mcp342xFRAME_SIZE(Count) bytes, any alignment
+ * @param	Force - build even if no framed channel has a new sample
+ * @return	frame length, 0 if nothing new, else error code
+ * @note	Consecutive entries on the same device form one consistent snapshot
+ */
+int	mcp342xFrameBuild(u8_t * pu8Buf, int Size, int Force) {
+	if (pu8Buf == NULL) return erINV_PARA;
+	xRtosSemaphoreTake(&sFrame.mux, portMAX_DELAY);
+	int iRV = mcp342xFRAME_SIZE(sFrame.Count);
+	if (sFrame.Count == 0) {
+		iRV = erINV_STATE;
+		goto exit;
+	}
+	if (Size < iRV) {
+		iRV = erINV_PARA;
+		goto exit;
+	}
+	mcp342x_fhdr_t * psH = (mcp342x_fhdr_t *) pu8Buf;
+	mcp342x_fent_t * psE = (mcp342x_fent_t *) (pu8Buf + sizeof(mcp342x_fhdr_t));
+	u32_t tBase = (u32_t) esp_timer_get_time();
+	u16_t u16Seq[mcp342xMAX_CH];
+	int New = sFrame.Fresh;
+	for (int First = 0, Last; First < sFrame.Count; First = Last + 1) {
+		mcp342x_t * psMCP342X = psaMCP342X;				// run of entries on one device
+		while (sFrame.Ch[First] > psMCP342X->ChHi) ++psMCP342X;
+		for (Last = First; Last + 1 < sFrame.Count && INRANGE(psMCP342X->ChLo, sFrame.Ch[Last + 1], psMCP342X->ChHi); ++Last);
+		New |= mcp342xFramePack(psE, u16Seq, First, Last, tBase);
+	}
+	if (New == 0 && Force == 0) {
+		++sFrame.Empty;
+		iRV = 0;
+		goto exit;
+	}
+	for (int i = 0; i < sFrame.Count; ++i) {
+		psE[i].LogCh = sFrame.Ch[i];
+		sFrame.Seq[i] = u16Seq[i];
+	}
+	sFrame.Fresh = 0;
+	psH->Magic = mcp342xFRAME_MAGIC;
+	psH->Ver = mcp342xFRAME_VER;
+	psH->Count = sFrame.Count;
+	psH->FrameNo = sFrame.FrameNo++;
+	psH->Len = iRV;
+	psH->tBase = tBase;
+	++sFrame.Frames;
+	sFrame.Bytes += iRV;
+exit:
+	xRtosSemaphoreGive(&sFrame.mux);
+	return iRV;
+}
+
+/**
+ * mcp342xFrameReport() - frame builder statistics
+ */
+int	mcp342xFrameReport(report_t * psR) {
+	if (sFrame.Count == 0 && sFrame.Frames == 0) return 0;
+	return wprintfx(psR, "Frame Ch=%d  Len=%d  Frames=%lu  Bytes=%lu  Empty=%lu  Retry=%lu  Mode=%s\r\n", sFrame.Count,
+			sFrame.Count ? (int) mcp342xFRAME_SIZE(sFrame.Count) : 0, sFrame.Frames, sFrame.Bytes, sFrame.Empty,
+			sFrame.Retries, sFrame.thNotify ? "notify" : "poll");
+}
+
+#endif
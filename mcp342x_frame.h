@@ -0,0 +1,52 @@
+/*
+ * mcp342x_frame.h - Copyright (c) 2021-24 Andre M. Maree/KSS Technologies (Pty) Ltd.
+ */
+
+#pragma once
+
+#include "mcp342x.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ############################################# Macros ############################################
+
+#define	mcp342xFRAME_MAGIC			0x464D				// "MF", little endian
+#define	mcp342xFRAME_VER			1
+#define	mcp342xFRAME_SIZE(Count)	(sizeof(mcp342x_fhdr_t) + (Count) * sizeof(mcp342x_fent_t))
+
+// ######################################### Structures ############################################
+
+/* Frame = header + 1 entry per configured channel, in configured order, all little endian.
+ * Code & Cfg as stored, receiver scales: Volts = Code * 2.048 / (2^(RATE*2+11) * 2^PGA) */
+typedef struct __attribute__((packed)) mcp342x_fhdr_t {
+	u16_t Magic;								// mcp342xFRAME_MAGIC
+	u8_t Ver;									// mcp342xFRAME_VER
+	u8_t Count;									// entries following
+	u16_t FrameNo;								// wraps, gap = frames not built
+	u16_t Len;									// bytes, header included
+	u32_t tBase;								// uS, frame built
+} mcp342x_fhdr_t;
+DUMB_STATIC_ASSERT(sizeof(mcp342x_fhdr_t) == 12);
+
+typedef struct __attribute__((packed)) mcp342x_fent_t {
+	u8_t Code[3];								// signed 24 bit conversion code
+	u8_t LogCh;
+	mcp342x_cfg_t Cfg;							// RATE & PGA Code was converted at
+	u8_t Flags;									// mcp342xSF_*, 0 = no sample
+	u16_t AgeMs;								// tBase - sample Time, saturates at 0xFFFF
+} mcp342x_fent_t;
+DUMB_STATIC_ASSERT(sizeof(mcp342x_fent_t) == 8);
+
+// ####################################### Public functions ########################################
+
+void mcp342xFrameSweep(int ChLo, int ChHi);
+int	mcp342xFrameConfig(const u8_t * pu8Ch, int Count, TaskHandle_t thNotify);
+int	mcp342xFrameBuild(u8_t * pu8Buf, int Size, int Force);
+struct report_t;
+int	mcp342xFrameReport(struct report_t * psR);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,451 @@
+//mcp342x_log.c - Copyright (c) 2021-24 Andre M. Maree / KSS Technologies (Pty) Ltd.
+
+#include "hal_platform.h"
+
+#if (HAL_MCP342X > 0)
+#include "endpoints.h"
+#include "mcp342x_log.h"
+#include "mcp342x_energy.h"
+#include "printfx.h"
+#include "syslog.h"
+#include "errors_events.h"
+
+#include "esp_timer.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#define	debugFLAG					0xF000
+
+#define	debugTIMING					(debugFLAG_GLOBAL & debugFLAG & 0x1000)
+#define	debugTRACK					(debugFLAG_GLOBAL & debugFLAG & 0x2000)
+#define	debugPARAM					(debugFLAG_GLOBAL & debugFLAG & 0x4000)
+#define	debugRESULT					(debugFLAG_GLOBAL & debugFLAG & 0x8000)
+
+// ##################################### Developer notes ###########################################
+
+/* Acquisition (timer task) only ever copies a stored sample into the channel ring, it never
+ * waits. When the ring fills the channel policy applies: DROP discards the new sample,
+ * DECIMATE keeps 1 in 2 beyond half full and 1 in 4 beyond 3/4, then drops, OVERWRITE always
+ * writes and the consumer skips what was overwritten, detected from the indices after copying
+ * each record out. Every loss is counted and shows as a sequence gap. The encoder task drains the rings
+ * into the active block buffer, delta & varint compressed, and wakes early when a ring passes
+ * half full. Full blocks go to the writer task, which owns the file, while the encoder fills
+ * the other buffer. Blocks are always written whole, so the file stays block aligned and the
+ * file system never has to read-modify-write a partially written sector. A file left with a
+ * torn last block (power lost mid write) is padded with 0xFF up to the next boundary on start.
+ * A released ring is only freed by the encoder, rings released again before it gets there are
+ * chained per channel rather than replacing the pending one.
+ * mcp342xLogDecode() is the exact reverse of the encoder, for host tools reading the file back
+ * and for the round trip unit test.
+ * The encoder task also provides the background context for mcp342xEnergySync().
+ */
+
+// ###################################### Local variables ##########################################
+
+static mcp342x_ring_t * psaRing[mcp342xMAX_CH] = { NULL };
+static mcp342x_ring_t * psaRetire[mcp342xMAX_CH] = { NULL };	// chains, freed by encoder task
+static u32_t LogSubs = 0;							// channels holding a mcp342xSUB_LOG subscription
+
+static struct {
+	FILE * psFile;
+	u8_t * pu8Buf[2];
+	TaskHandle_t thEnc, thWr;
+	volatile i8_t Full;							// buffer index with writer, -1 if none
+	volatile u8_t Run;
+	u8_t Act;									// buffer being encoded
+	u32_t BlkNo;
+	u32_t Seen;									// channels with a record in the current block
+	u32_t SeqSeen;								// channels with PrevSeq valid
+	u16_t PrevSeq[mcp342xMAX_CH];
+	u32_t PrevT[mcp342xMAX_CH];
+	i32_t PrevC[mcp342xMAX_CH];
+	u8_t PrevCfg[mcp342xMAX_CH], PrevFlg[mcp342xMAX_CH];
+} sLog = { .Full = -1 };
+
+static mcp342x_lstat_t sLogStat = { 0 };
+
+// ################################ Local ONLY utility functions ###################################
+
+static u8_t * mcp342xLogVarint(u8_t * pu8, i32_t Val) {
+	u32_t Z = ((u32_t) Val << 1) ^ (u32_t) (Val >> 31);	// zigzag
+	while (Z >= 0x80) {
+		*pu8++ = (Z & 0x7F) | 0x80;
+		Z >>= 7;
+	}
+	*pu8++ = Z;
+	return pu8;
+}
+
+static const u8_t * mcp342xLogUnvarint(const u8_t * pu8, const u8_t * pu8End, i32_t * pVal) {
+	u32_t Z = 0;
+	for (int Sh = 0; Sh < 35; Sh += 7) {
+		if (pu8 >= pu8End) break;
+		u8_t b = *pu8++;
+		Z |= (u32_t) (b & 0x7F) << Sh;
+		if ((b & 0x80) == 0) {
+			*pVal = (i32_t) (Z >> 1) ^ -(i32_t) (Z & 1);	// un-zigzag
+			return pu8;
+		}
+	}
+	return NULL;										// truncated or over long
+}
+
+static void mcp342xLogNewBlock(u32_t tBase) {
+	mcp342x_lbh_t * psH = (mcp342x_lbh_t *) sLog.pu8Buf[sLog.Act];
+	memset(sLog.pu8Buf[sLog.Act], 0xFF, mcp342xLOG_BLOCK);
+	*psH = (mcp342x_lbh_t) { .Magic = mcp342xLOG_MAGIC, .BlkNo = sLog.BlkNo++, .tBase = tBase, .Used = sizeof(mcp342x_lbh_t) };
+	sLog.Seen = 0;
+}
+
+/**
+ * mcp342xLogHandoff() - pass the active block to the writer, continue in the other buffer
+ * @note	Waits only if the writer still has the previous block, acquisition is unaffected
+ */
+static void mcp342xLogHandoff(void) {
+	mcp342x_lbh_t * psH = (mcp342x_lbh_t *) sLog.pu8Buf[sLog.Act];
+	if (psH->Recs == 0) return;
+	if (sLog.Full >= 0) {
+		++sLogStat.Waits;
+		while (sLog.Full >= 0) ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+	}
+	sLog.Full = sLog.Act;
+	xTaskNotifyGive(sLog.thWr);
+	sLog.Act ^= 1;
+	psH = (mcp342x_lbh_t *) sLog.pu8Buf[sLog.Act];
+	psH->Recs = 0;										// not yet initialised
+}
+
+static void mcp342xLogEncode(int LogCh, const mcp342x_smp_t * psSmp) {
+	mcp342x_lbh_t * psH = (mcp342x_lbh_t *) sLog.pu8Buf[sLog.Act];
+	if (psH->Recs && psH->Used > mcp342xLOG_BLOCK - mcp342xLOG_RECMAX) mcp342xLogHandoff();
+	psH = (mcp342x_lbh_t *) sLog.pu8Buf[sLog.Act];
+	if (psH->Recs == 0) mcp342xLogNewBlock(psSmp->Time);
+	u32_t Bit = 1UL << LogCh;
+	if ((sLog.Seen & Bit) == 0) {
+		sLog.PrevT[LogCh] = psH->tBase;
+		sLog.PrevC[LogCh] = 0;
+	}
+	u8_t * pu8 = sLog.pu8Buf[sLog.Act] + psH->Used;
+	u8_t Hdr = LogCh;
+	u16_t Gap = (sLog.SeqSeen & Bit) ? mcp342xSEQ_GAP(sLog.PrevSeq[LogCh], psSmp->Seq) : 0;
+	if (Gap) sLogStat.Gaps += Gap;
+	if ((sLog.Seen & Bit) == 0 || Gap) Hdr |= 0x20;
+	if ((sLog.Seen & Bit) == 0 || psSmp->Cfg.Conf != sLog.PrevCfg[LogCh]) Hdr |= 0x40;
+	if ((sLog.Seen & Bit) == 0 || psSmp->Flags != sLog.PrevFlg[LogCh]) Hdr |= 0x80;
+	*pu8++ = Hdr;
+	if (Hdr & 0x20) pu8 = mcp342xLogVarint(pu8, psSmp->Seq);
+	if (Hdr & 0x40) *pu8++ = sLog.PrevCfg[LogCh] = psSmp->Cfg.Conf;
+	if (Hdr & 0x80) *pu8++ = sLog.PrevFlg[LogCh] = psSmp->Flags;
+	pu8 = mcp342xLogVarint(pu8, (i32_t) (psSmp->Time - sLog.PrevT[LogCh]));
+	pu8 = mcp342xLogVarint(pu8, psSmp->Code - sLog.PrevC[LogCh]);
+	sLog.PrevT[LogCh] = psSmp->Time;
+	sLog.PrevC[LogCh] = psSmp->Code;
+	sLog.PrevSeq[LogCh] = psSmp->Seq;
+	sLog.SeqSeen |= Bit;
+	sLog.Seen |= Bit;
+	psH->Used = pu8 - sLog.pu8Buf[sLog.Act];
+	++psH->Recs;
+	++sLogStat.Recs;
+	sLogStat.RawBytes += sizeof(mcp342x_smp_t);
+}
+
+static void mcp342xLogFreeChain(mcp342x_ring_t * psRing) {
+	while (psRing) {
+		mcp342x_ring_t * psNext = psRing->psNext;
+		vRtosFree(psRing);
+		psRing = psNext;
+	}
+}
+
+static void mcp342xLogDrain(void) {
+	for (int LogCh = 0; LogCh < mcp342xNumCh; ++LogCh) {
+		mcp342x_ring_t * psOld = __atomic_exchange_n(&psaRetire[LogCh], NULL, __ATOMIC_ACQ_REL);
+		if (psOld) {									// no longer referenced by either side
+			mcp342xLogFreeChain(psOld);
+			sLog.SeqSeen &= ~(1UL << LogCh);			// restart gap tracking when re-enabled
+		}
+		mcp342x_ring_t * psRing = psaRing[LogCh];
+		if (psRing == NULL) continue;
+		u16_t Tail = psRing->Tail;
+		while (1) {
+			int Ovw = (psRing->Policy == mcp342xOVF_OVERWRITE);
+			u16_t Head = psRing->Head;
+			__sync_synchronize();
+			u16_t Used = Head - Tail;
+			if (Used == 0) break;
+			if (Used > mcp342xLOG_RING - Ovw) {			// overwritten, skip to oldest intact
+				psRing->Over += Used - (mcp342xLOG_RING - 1);
+				Tail = Head - (mcp342xLOG_RING - 1);
+			}
+			mcp342x_smp_t sSmp = psRing->Rec[Tail & (mcp342xLOG_RING - 1)];
+			__sync_synchronize();
+			if (Ovw && (u16_t) (psRing->Head - Tail) >= mcp342xLOG_RING) continue;	// overwritten while copied
+			mcp342xLogEncode(LogCh, &sSmp);
+			psRing->Tail = ++Tail;
+		}
+	}
+}
+
+static void mcp342xLogEncTask(void * pvPara) {
+	while (sLog.Run) {
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(mcp342xLOG_PERIOD_MS));
+		mcp342xLogDrain();
+		mcp342xEnergySync(0);
+	}
+	mcp342xLogDrain();
+	mcp342xLogHandoff();								// partial last block
+	while (sLog.Full >= 0) ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+	TaskHandle_t thWr = sLog.thWr;
+	sLog.thEnc = NULL;
+	xTaskNotifyGive(thWr);								// writer exits & cleans up
+	vTaskDelete(NULL);
+}
+
+static void mcp342xLogWrTask(void * pvPara) {
+	while (1) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		if (sLog.Full >= 0) {
+			u64_t tStart = esp_timer_get_time();
+			if (fwrite(sLog.pu8Buf[(int) sLog.Full], 1, mcp342xLOG_BLOCK, sLog.psFile) != mcp342xLOG_BLOCK ||
+				fflush(sLog.psFile) != 0 || fsync(fileno(sLog.psFile)) != 0) {	// on flash before counted
+				if (sLogStat.Fails++ == 0) SL_ERR("MCP342X log write failed");
+			} else {
+				++sLogStat.Blocks;
+				sLogStat.LogBytes += mcp342xLOG_BLOCK;
+			}
+			u32_t tUs = esp_timer_get_time() - tStart;
+			if (tUs > sLogStat.MaxWrUs) sLogStat.MaxWrUs = tUs;
+			sLog.Full = -1;
+			TaskHandle_t thEnc = sLog.thEnc;
+			if (thEnc) xTaskNotifyGive(thEnc);
+		}
+		if (sLog.thEnc == NULL && sLog.Run == 0) break;
+	}
+	fclose(sLog.psFile);
+	sLog.psFile = NULL;
+	vRtosFree(sLog.pu8Buf[0]);
+	sLog.pu8Buf[0] = sLog.pu8Buf[1] = NULL;
+	sLog.thWr = NULL;
+	vTaskDelete(NULL);
+}
+
+static void mcp342xLogRetire(void * pvPara, u32_t LogCh) {	// timer task, after any push in progress
+	mcp342x_ring_t * psRing = pvPara;
+	if (sLog.thEnc) {									// encoder may still be draining, chain it
+		psRing->psNext = __atomic_load_n(&psaRetire[LogCh], __ATOMIC_ACQUIRE);
+		while (__atomic_compare_exchange_n(&psaRetire[LogCh], &psRing->psNext, psRing, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) == 0);
+	} else {											// encoder gone, free with anything left over
+		psRing->psNext = __atomic_exchange_n(&psaRetire[LogCh], NULL, __ATOMIC_ACQ_REL);
+		mcp342xLogFreeChain(psRing);
+		sLog.SeqSeen &= ~(1UL << LogCh);
+	}
+}
+
+// ####################################### Public functions ########################################
+
+/**
+ * mcp342xLogPush() - queue a stored sample for logging, never blocks
+ * @note	Called from the conversion path (timer task)
+ */
+void mcp342xLogPush(int LogCh, const mcp342x_smp_t * psSmp) {
+	mcp342x_ring_t * psRing = psaRing[LogCh];
+	if (psRing == NULL || sLog.thEnc == NULL) return;	// not draining, nothing to queue for
+	u16_t Head = psRing->Head, Used = Head - psRing->Tail;
+	if (psRing->Policy == mcp342xOVF_DECIMATE && Used >= mcp342xLOG_RING / 2) {
+		u8_t Keep = (Used >= (mcp342xLOG_RING * 3) / 4) ? 4 : 2;
+		if (++psRing->Dec % Keep) {
+			++psRing->Decim;
+			return;
+		}
+	}
+	if (Used >= mcp342xLOG_RING && psRing->Policy != mcp342xOVF_OVERWRITE) {
+		++psRing->Drops;
+		return;
+	}
+	psRing->Rec[Head & (mcp342xLOG_RING - 1)] = *psSmp;
+	__sync_synchronize();
+	psRing->Head = Head + 1;
+	if (Used >= mcp342xLOG_RING / 2) xTaskNotifyGive(sLog.thEnc);	// wake encoder early
+}
+
+/**
+ * mcp342xLogChan() - start/stop logging a channel, allocates its ring
+ * @note	A logged channel is subscribed (mcp342xSUB_LOG) so it stays at full rate. The ring is
+ *			freed if the channel is disabled, the subscription is kept, enable again to resume.
+ */
+int	mcp342xLogChan(int LogCh, int Enable) {
+	if (OUTSIDE(0, LogCh, mcp342xNumCh - 1)) return erINV_PARA;
+	u32_t Bit = 1UL << LogCh;
+	if (Enable) {
+		if (psaRing[LogCh] == NULL) {
+			mcp342x_ring_t * psRing = pvRtosMalloc(sizeof(mcp342x_ring_t));
+			if (psRing == NULL) return erNO_MEM;
+			memset(psRing, 0, sizeof(mcp342x_ring_t));
+			psaRing[LogCh] = psRing;
+		}
+		if ((LogSubs & Bit) == 0 && mcp342xSubscribe(LogCh, mcp342xSUB_LOG, 0) == erSUCCESS) LogSubs |= Bit;
+		return erSUCCESS;
+	}
+	if (LogSubs & Bit) {
+		mcp342xUnsubscribe(LogCh, mcp342xSUB_LOG);
+		LogSubs &= ~Bit;
+	}
+	mcp342xLogRelease(LogCh);
+	return erSUCCESS;
+}
+
+/**
+ * mcp342xLogRelease() - stop logging a channel & free its ring, subscriptions untouched
+ * @note	From the timer task (channel disabled) no push can be in progress, retired directly
+ */
+void mcp342xLogRelease(int LogCh) {
+	mcp342x_ring_t * psRing = psaRing[LogCh];
+	if (psRing == NULL) return;
+	psaRing[LogCh] = NULL;
+	if (xTaskGetCurrentTaskHandle() == xTimerGetTimerDaemonTaskHandle()) {
+		mcp342xLogRetire(psRing, LogCh);
+	} else if (xTimerPendFunctionCall(mcp342xLogRetire, psRing, LogCh, portMAX_DELAY) != pdPASS) {
+		SL_ERR("MCP342X log ring leaked");
+	}
+}
+
+/**
+ * mcp342xLogPolicy() - set what happens to a channel's samples when its ring is full
+ * @param	Policy - mcp342xOVF_DROP (default), mcp342xOVF_OVERWRITE or mcp342xOVF_DECIMATE
+ */
+int	mcp342xLogPolicy(int LogCh, int Policy) {
+	if (OUTSIDE(0, LogCh, mcp342xNumCh - 1) || OUTSIDE(0, Policy, mcp342xOVF_NUM - 1)) return erINV_PARA;
+	mcp342x_ring_t * psRing = psaRing[LogCh];
+	if (psRing == NULL) return erINV_STATE;
+	psRing->Policy = Policy;
+	return erSUCCESS;
+}
+
+/**
+ * mcp342xLogStart() - open (append) the log file and start the encoder & writer tasks
+ * @param	pcPath - file on a mounted VFS (FAT, LittleFS, SPIFFS...)
+ * @param	Prio - task priority, should be below that of the RTOS timer task
+ */
+int	mcp342xLogStart(const char * pcPath, int Prio) {
+	if (pcPath == NULL) return erINV_PARA;
+	if (sLog.thEnc || sLog.thWr) return erINV_STATE;	// running or still stopping
+	u8_t * pu8Buf = pvRtosMalloc(2 * mcp342xLOG_BLOCK);
+	if (pu8Buf == NULL) return erNO_MEM;
+	sLog.psFile = fopen(pcPath, "ab");
+	if (sLog.psFile == NULL) {
+		vRtosFree(pu8Buf);
+		return erFAILURE;
+	}
+	if (fseek(sLog.psFile, 0, SEEK_END) != 0) goto fail;
+	long Size = ftell(sLog.psFile);
+	if (Size < 0) goto fail;
+	if (Size % mcp342xLOG_BLOCK) {						// torn last block, pad so new blocks stay aligned
+		int Pad = mcp342xLOG_BLOCK - (Size % mcp342xLOG_BLOCK);
+		memset(pu8Buf, 0xFF, Pad);
+		if (fwrite(pu8Buf, 1, Pad, sLog.psFile) != (size_t) Pad || fflush(sLog.psFile) != 0 ||
+			fsync(fileno(sLog.psFile)) != 0) {
+			goto fail;
+		}
+		SL_WARN("MCP342X log padded %d bytes to block boundary", Pad);
+	}
+	sLog.pu8Buf[0] = pu8Buf;
+	sLog.pu8Buf[1] = pu8Buf + mcp342xLOG_BLOCK;
+	((mcp342x_lbh_t *) pu8Buf)->Recs = 0;
+	sLog.Act = 0;
+	sLog.Full = -1;
+	sLog.Run = 1;
+	if (xTaskCreate(mcp342xLogWrTask, "mcp342xWr", 3072, NULL, Prio, &sLog.thWr) != pdPASS) goto fail;
+	if (xTaskCreate(mcp342xLogEncTask, "mcp342xLog", 3072, NULL, Prio, &sLog.thEnc) != pdPASS) {
+		sLog.Run = 0;									// writer cleans up & exits
+		xTaskNotifyGive(sLog.thWr);
+		return erFAILURE;
+	}
+	return erSUCCESS;
+fail:
+	sLog.Run = 0;
+	fclose(sLog.psFile);
+	sLog.psFile = NULL;
+	vRtosFree(pu8Buf);
+	sLog.pu8Buf[0] = sLog.pu8Buf[1] = NULL;
+	return erFAILURE;
+}
+
+/**
+ * mcp342xLogDecode() - decode one log block, reverse of the encoder
+ * @param	pu8Blk - mcp342xLOG_BLOCK bytes as read from the file, any alignment
+ * @param	cb - called for each record in block order
+ * @return	records decoded, 0 for an erased (padding) block, erINV_PARA if not a log block
+ *			or erFAILURE if corrupt, records before the corruption have been passed to cb
+ */
+int	mcp342xLogDecode(const u8_t * pu8Blk, mcp342x_ldec_cb_t cb, void * pvCtx) {
+	mcp342x_lbh_t sH;
+	memcpy(&sH, pu8Blk, sizeof(sH));
+	if (sH.Magic == 0xFFFFFFFFUL) return 0;
+	if (sH.Magic != mcp342xLOG_MAGIC) return erINV_PARA;
+	if (sH.Used < sizeof(sH) || sH.Used > mcp342xLOG_BLOCK) return erFAILURE;
+	const u8_t * pu8 = pu8Blk + sizeof(sH), * pu8End = pu8Blk + sH.Used;
+	u32_t Seen = 0, PrevT[mcp342xMAX_CH];
+	i32_t PrevC[mcp342xMAX_CH];
+	mcp342x_smp_t sPrev[mcp342xMAX_CH];
+	int Recs = 0;
+	while (pu8 < pu8End) {
+		u8_t Hdr = *pu8++;
+		int LogCh = Hdr & 0x1F;
+		if (LogCh >= mcp342xMAX_CH) return erFAILURE;
+		u32_t Bit = 1UL << LogCh;
+		if ((Seen & Bit) == 0) {						// first in block carries everything
+			if ((Hdr & 0xE0) != 0xE0) return erFAILURE;
+			PrevT[LogCh] = sH.tBase;
+			PrevC[LogCh] = 0;
+		}
+		mcp342x_smp_t * psS = &sPrev[LogCh];
+		i32_t Val;
+		if (Hdr & 0x20) {
+			if ((pu8 = mcp342xLogUnvarint(pu8, pu8End, &Val)) == NULL) return erFAILURE;
+			psS->Seq = Val;
+		} else {
+			++psS->Seq;
+		}
+		if ((Hdr & 0x40) && pu8 < pu8End) psS->Cfg.Conf = *pu8++;
+		if ((Hdr & 0x80) && pu8 < pu8End) psS->Flags = *pu8++;
+		if ((pu8 = mcp342xLogUnvarint(pu8, pu8End, &Val)) == NULL) return erFAILURE;
+		psS->Time = PrevT[LogCh] = PrevT[LogCh] + (u32_t) Val;
+		if ((pu8 = mcp342xLogUnvarint(pu8, pu8End, &Val)) == NULL) return erFAILURE;
+		psS->Code = PrevC[LogCh] = (i32_t) ((u32_t) PrevC[LogCh] + (u32_t) Val);
+		Seen |= Bit;
+		++Recs;
+		if (cb) cb(LogCh, psS, pvCtx);
+	}
+	return (Recs == sH.Recs) ? Recs : erFAILURE;
+}
+
+/**
+ * mcp342xLogStop() - flush remaining samples & close the file, completes in the background
+ */
+int	mcp342xLogStop(void) {
+	if (sLog.Run == 0) return erINV_STATE;
+	sLog.Run = 0;
+	xTaskNotifyGive(sLog.thEnc);
+	return erSUCCESS;
+}
+
+int	mcp342xLogReport(report_t * psR) {
+	int iRV = 0;
+	u32_t Drops = 0, Decim = 0, Over = 0, Rings = 0;
+	for (int LogCh = 0; LogCh < mcp342xNumCh; ++LogCh) {
+		mcp342x_ring_t * psRing = psaRing[LogCh];
+		if (psRing == NULL) continue;
+		++Rings;
+		Drops += psRing->Drops;
+		Decim += psRing->Decim;
+		Over += psRing->Over;
+	}
+	if (Rings == 0 && sLogStat.Recs == 0) return 0;
+	iRV += wprintfx(psR, "Log %s  Ch=%lu  Rec=%lu  Drop=%lu  Dec=%lu  Ovw=%lu  Gap=%lu  Blk=%lu  Fail=%lu  Wait=%lu  MaxWr=%luuS  Ratio=%.2f\r\n",
+			sLog.Run ? "run" : "stop", Rings, sLogStat.Recs, Drops, Decim, Over, sLogStat.Gaps, sLogStat.Blocks, sLogStat.Fails, sLogStat.Waits,
+			sLogStat.MaxWrUs, sLogStat.LogBytes ? (double) sLogStat.RawBytes / (double) sLogStat.LogBytes : 0.0);
+	return iRV;
+}
+
+#endif
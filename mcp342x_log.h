@@ -0,0 +1,78 @@
+/*
+ * mcp342x_log.h - Copyright (c) 2021-24 Andre M. Maree/KSS Technologies (Pty) Ltd.
+ */
+
+#pragma once
+
+#include "mcp342x.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ############################################# Macros ############################################
+
+#define	mcp342xLOG_RING				64					// samples per channel ring, power of 2
+#define	mcp342xLOG_BLOCK			4096				// bytes per block, flash sector/page aligned
+#define	mcp342xLOG_RECMAX			16					// worst case encoded record size
+#define	mcp342xLOG_MAGIC			0x474C334DUL		// "M3LG"
+#define	mcp342xLOG_PERIOD_MS		1000				// max time between ring drains
+
+// ######################################## Enumerations ###########################################
+
+// Ring full: discard new sample | replace oldest sample | thin samples progressively as it fills
+enum { mcp342xOVF_DROP, mcp342xOVF_OVERWRITE, mcp342xOVF_DECIMATE, mcp342xOVF_NUM };
+
+// ######################################### Structures ############################################
+
+typedef struct mcp342x_ring_t {					// single producer (timer task) single consumer
+	volatile u16_t Head;						// next slot written, producer only
+	volatile u16_t Tail;						// next slot read, consumer only
+	u8_t Policy;								// mcp342xOVF_*
+	u8_t Dec;									// decimation phase, producer only
+	u32_t Drops;								// new samples discarded, ring full (producer)
+	u32_t Decim;								// samples thinned out by DECIMATE (producer)
+	u32_t Over;									// oldest samples overwritten (consumer)
+	struct mcp342x_ring_t * psNext;				// retired, next older ring awaiting free
+	mcp342x_smp_t Rec[mcp342xLOG_RING];
+} mcp342x_ring_t;
+
+/* Block = header + records, unused tail 0xFF. Every block decodes on its own.
+ * Record: u8 LogCh | 0x20 Seq follows | 0x40 Cfg follows | 0x80 Flags follows,
+ *		[varint Seq, first record of channel in block or after a gap, else previous + 1],
+ *		[u8 Cfg], [u8 Flags],
+ *		varint zigzag(Time - previous Time of channel, tBase for the first)
+ *		varint zigzag(Code - previous Code of channel, 0 for the first) */
+typedef struct mcp342x_lbh_t {					// log block header
+	u32_t Magic;
+	u32_t BlkNo;
+	u32_t tBase;								// uS, time of first record
+	u16_t Used;									// bytes, header included
+	u16_t Recs;
+} mcp342x_lbh_t;
+
+typedef struct mcp342x_lstat_t {
+	u32_t Recs, Blocks, Fails;
+	u32_t Waits;								// encoder waited for writer
+	u32_t Gaps;									// samples missing from the log, drops & skips
+	u32_t MaxWrUs;
+	u64_t RawBytes, LogBytes;					// RawBytes = Recs * sample size
+} mcp342x_lstat_t;
+
+typedef void (* mcp342x_ldec_cb_t)(int LogCh, const mcp342x_smp_t * psSmp, void * pvCtx);
+
+// ####################################### Public functions ########################################
+
+void mcp342xLogPush(int LogCh, const mcp342x_smp_t * psSmp);
+int	mcp342xLogChan(int LogCh, int Enable);
+void mcp342xLogRelease(int LogCh);
+int	mcp342xLogPolicy(int LogCh, int Policy);
+int	mcp342xLogStart(const char * pcPath, int Prio);
+int	mcp342xLogStop(void);
+int	mcp342xLogDecode(const u8_t * pu8Blk, mcp342x_ldec_cb_t cb, void * pvCtx);
+struct report_t;
+int	mcp342xLogReport(struct report_t * psR);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,221 @@
+//mcp342x_modbus.c - Copyright (c) 2021-24 Andre M. Maree / KSS Technologies (Pty) Ltd.
+
+#include "hal_platform.h"
+
+#if (HAL_MCP342X > 0)
+#include "endpoints.h"
+#include "mcp342x_modbus.h"
+#include "printfx.h"
+#include "syslog.h"
+#include "errors_events.h"
+
+#include "esp_timer.h"
+
+#include <math.h>
+
+#define	debugFLAG					0xF000
+
+#define	debugTIMING					(debugFLAG_GLOBAL & debugFLAG & 0x1000)
+#define	debugTRACK					(debugFLAG_GLOBAL & debugFLAG & 0x2000)
+#define	debugPARAM					(debugFLAG_GLOBAL & debugFLAG & 0x4000)
+#define	debugRESULT					(debugFLAG_GLOBAL & debugFLAG & 0x8000)
+
+// ##################################### Developer notes ###########################################
+
+/* Polls are served from the sample store only, nothing is converted or scaled ahead of time
+ * and the sense path is never involved. Each request first copies the whole store, at most
+ * mcp342xMAX_CH * 12 bytes, under the seqlock of every device and retries if any device
+ * stored meanwhile, so all registers in one response, including both halves of every 32 bit
+ * value, come from the same instant. Registers are then computed from that copy.
+ * Transport is left to the application: hand a received TCP ADU or RTU frame to
+ * mcp342xModbusTCP() / mcp342xModbusRTU() and send back what they return, if anything.
+ * Channels follow their normal subscription & idle policy, polling does not keep them running.
+ */
+
+// ###################################### Local variables ##########################################
+
+static struct {
+	u8_t Unit;									// RTU address & TCP unit id, 0 = any
+	u8_t Swap;									// 32 bit values low word first
+} sMB = { .Unit = 1 };
+
+static mcp342x_mbstat_t sMBStat = { 0 };
+
+// ################################ Local ONLY utility functions ###################################
+
+static u16_t mcp342xMBGet16(const u8_t * pu8) { return (pu8[0] << 8) | pu8[1]; }
+
+static void mcp342xMBPut16(u8_t * pu8, u16_t u16) {
+	pu8[0] = u16 >> 8;
+	pu8[1] = u16;
+}
+
+/**
+ * mcp342xMBCRC() - Modbus RTU CRC16, polynomial 0xA001 reflected, initial 0xFFFF
+ */
+static u16_t mcp342xMBCRC(const u8_t * pu8, int Len) {
+	u16_t CRC = 0xFFFF;
+	while (Len--) {
+		CRC ^= *pu8++;
+		for (int i = 0; i < 8; ++i) CRC = (CRC & 1) ? (CRC >> 1) ^ 0xA001 : CRC >> 1;
+	}
+	return CRC;
+}
+
+/**
+ * mcp342xMBSnap() - copy of the whole sample store, consistent across all devices
+ * @param	psSS - mcp342xMAX_CH entries
+ * @return	erSUCCESS or erINV_STATE if the store is larger than the copy
+ */
+static int mcp342xMBSnap(mcp342x_smp_t * psSS) {
+	if (mcp342xNumDev > mcp342xMAX_DEV || mcp342xNumCh > mcp342xMAX_CH) return erINV_STATE;
+	u32_t Seq[mcp342xMAX_DEV];
+	for (;;) {
+		for (int eDev = 0; eDev < mcp342xNumDev; ++eDev) Seq[eDev] = mcp342xSnapBegin(psaMCP342X[eDev].ChLo);
+		memcpy(psSS, psaMCP342X_SS, mcp342xNumCh * sizeof(mcp342x_smp_t));
+		int eDev = 0;
+		while (eDev < mcp342xNumDev && mcp342xSnapRetry(psaMCP342X[eDev].ChLo, Seq[eDev]) == 0) ++eDev;
+		if (eDev == mcp342xNumDev) break;
+		++sMBStat.Retries;
+	}
+	return erSUCCESS;
+}
+
+/**
+ * mcp342xMBReg() - value of a single register computed from the snapshot
+ * @return	erSUCCESS or erINV_PARA if not mapped
+ */
+static int mcp342xMBReg(const mcp342x_smp_t * psSS, u16_t Addr, u32_t tNow, u16_t * pu16) {
+	int Blk = Addr / mcp342xMB_BLOCK, Ofs = Addr % mcp342xMB_BLOCK;
+	int Wide = (Blk <= (mcp342xMB_FLT / mcp342xMB_BLOCK));
+	int LogCh = Wide ? Ofs >> 1 : Ofs;
+	if (Blk >= mcp342xMB_NUM_BLK || LogCh >= mcp342xNumCh) return erINV_PARA;
+	const mcp342x_smp_t * psSmp = &psSS[LogCh];
+	u32_t u32 = 0;
+	switch (Blk * mcp342xMB_BLOCK) {
+	case mcp342xMB_RAW: u32 = psSmp->Code; break;
+	case mcp342xMB_UV: u32 = (i32_t) lround(mcp342xSampleVolts(psSmp) * 1e6); break;
+	case mcp342xMB_FLT: {
+		float f32 = mcp342xSampleVolts(psSmp);
+		memcpy(&u32, &f32, sizeof(u32));
+		break;
+	}
+	case mcp342xMB_STAT:
+		u32 = psSmp->Flags | (psSmp->Cfg.PGA << mcp342xMB_ST_PGA_S) | (psSmp->Cfg.RATE << mcp342xMB_ST_RATE_S);
+		break;
+	case mcp342xMB_SEQ: u32 = psSmp->Seq; break;
+	case mcp342xMB_AGE:
+		u32 = (psSmp->Flags & mcp342xSF_VALID) ? (tNow - psSmp->Time) / 1000 : UINT16_MAX;
+		if (u32 > UINT16_MAX) u32 = UINT16_MAX;
+		break;
+	}
+	if (Wide) {
+		int Hi = ((Ofs & 1) == 0) ^ sMB.Swap;			// this register holds the high word
+		*pu16 = Hi ? u32 >> 16 : u32;
+	} else {
+		*pu16 = u32;
+	}
+	return erSUCCESS;
+}
+
+static int mcp342xMBExcept(u8_t * pu8Rsp, u8_t FC, u8_t Code) {
+	++sMBStat.Excepts;
+	pu8Rsp[0] = FC | 0x80;
+	pu8Rsp[1] = Code;
+	return 2;
+}
+
+// ####################################### Public functions ########################################
+
+/**
+ * mcp342xModbusConfig() - set RTU address / TCP unit id and 32 bit word order
+ * @param	Unit - 1 to 247, 0 = respond to any
+ * @param	Swap - 0 = high word first (ABCD), 1 = low word first (CDAB)
+ */
+int	mcp342xModbusConfig(u8_t Unit, u8_t Swap) {
+	if (Unit > 247 || Swap > 1) return erINV_PARA;
+	sMB.Unit = Unit;
+	sMB.Swap = Swap;
+	return erSUCCESS;
+}
+
+/**
+ * mcp342xModbusPDU() - handle a request PDU (function code onwards)
+ * @return	response PDU length, exceptions included, or error code if no response possible
+ * @note	FC3 & FC4 read the same map, any other function gets an ILLEGAL FUNCTION exception
+ */
+int	mcp342xModbusPDU(const u8_t * pu8Req, int ReqLen, u8_t * pu8Rsp, int RspSize) {
+	if (ReqLen < 1 || RspSize < 2) return erINV_PARA;
+	++sMBStat.Reqs;
+	u8_t FC = pu8Req[0];
+	if (FC != 3 && FC != 4) return mcp342xMBExcept(pu8Rsp, FC, mcp342xMBX_FUNC);
+	if (ReqLen != 5) return mcp342xMBExcept(pu8Rsp, FC, mcp342xMBX_VALUE);
+	u16_t Addr = mcp342xMBGet16(&pu8Req[1]), Qty = mcp342xMBGet16(&pu8Req[3]);
+	if (OUTSIDE(1, Qty, mcp342xMB_MAX_QTY)) return mcp342xMBExcept(pu8Rsp, FC, mcp342xMBX_VALUE);
+	if (Addr + Qty > 0x10000) return mcp342xMBExcept(pu8Rsp, FC, mcp342xMBX_ADDR);	// range wraps
+	if (psaMCP342X_SS == NULL) return mcp342xMBExcept(pu8Rsp, FC, mcp342xMBX_ADDR);
+	if (RspSize < 2 + (Qty << 1)) return erINV_PARA;
+	mcp342x_smp_t sSS[mcp342xMAX_CH];
+	if (mcp342xMBSnap(sSS) < erSUCCESS) return mcp342xMBExcept(pu8Rsp, FC, mcp342xMBX_ADDR);
+	u32_t tNow = (u32_t) esp_timer_get_time();
+	for (int i = 0; i < Qty; ++i) {
+		u16_t u16;
+		if (mcp342xMBReg(sSS, Addr + i, tNow, &u16) < erSUCCESS) return mcp342xMBExcept(pu8Rsp, FC, mcp342xMBX_ADDR);
+		mcp342xMBPut16(&pu8Rsp[2 + (i << 1)], u16);
+	}
+	pu8Rsp[0] = FC;
+	pu8Rsp[1] = Qty << 1;
+	sMBStat.Regs += Qty;
+	return 2 + (Qty << 1);
+}
+
+/**
+ * mcp342xModbusTCP() - handle a Modbus TCP ADU, MBAP header + PDU
+ * @return	response ADU length, 0 if no response required, or error code
+ */
+int	mcp342xModbusTCP(const u8_t * pu8Req, int ReqLen, u8_t * pu8Rsp, int RspSize) {
+	if (RspSize < mcp342xMB_MBAP) return erINV_PARA;
+	if (ReqLen < mcp342xMB_MBAP + 1 || mcp342xMBGet16(&pu8Req[2]) != 0 ||	// protocol id 0 = Modbus
+		mcp342xMBGet16(&pu8Req[4]) != ReqLen - 6 ||
+		(sMB.Unit && pu8Req[6] != sMB.Unit && pu8Req[6] != 0xFF)) {
+		++sMBStat.Drops;
+		return 0;
+	}
+	int iRV = mcp342xModbusPDU(&pu8Req[mcp342xMB_MBAP], ReqLen - mcp342xMB_MBAP, &pu8Rsp[mcp342xMB_MBAP], RspSize - mcp342xMB_MBAP);
+	if (iRV < erSUCCESS) return iRV;
+	memcpy(pu8Rsp, pu8Req, 4);							// transaction & protocol id
+	mcp342xMBPut16(&pu8Rsp[4], iRV + 1);
+	pu8Rsp[6] = pu8Req[6];
+	return mcp342xMB_MBAP + iRV;
+}
+
+/**
+ * mcp342xModbusRTU() - handle a Modbus RTU frame, address + PDU + CRC
+ * @return	response frame length, 0 if no response required (other address, broadcast, bad CRC)
+ */
+int	mcp342xModbusRTU(const u8_t * pu8Req, int ReqLen, u8_t * pu8Rsp, int RspSize) {
+	if (RspSize < 4) return erINV_PARA;
+	if (ReqLen < 4 || mcp342xMBCRC(pu8Req, ReqLen - 2) != (pu8Req[ReqLen - 2] | (pu8Req[ReqLen - 1] << 8)) ||
+		pu8Req[0] == 0 || (sMB.Unit && pu8Req[0] != sMB.Unit)) {
+		++sMBStat.Drops;
+		return 0;
+	}
+	int iRV = mcp342xModbusPDU(&pu8Req[1], ReqLen - 3, &pu8Rsp[1], RspSize - 3);
+	if (iRV < erSUCCESS) return iRV;
+	pu8Rsp[0] = pu8Req[0];
+	u16_t CRC = mcp342xMBCRC(pu8Rsp, iRV + 1);
+	pu8Rsp[iRV + 1] = CRC;								// CRC low byte first
+	pu8Rsp[iRV + 2] = CRC >> 8;
+	return iRV + 3;
+}
+
+/**
+ * mcp342xModbusReport() - register server statistics
+ */
+int	mcp342xModbusReport(report_t * psR) {
+	if (sMBStat.Reqs == 0 && sMBStat.Drops == 0) return 0;
+	return wprintfx(psR, "Modbus Unit=%d  %s  Req=%lu  Reg=%lu  Exc=%lu  Drop=%lu  Retry=%lu\r\n", sMB.Unit,
+			sMB.Swap ? "CDAB" : "ABCD", sMBStat.Reqs, sMBStat.Regs, sMBStat.Excepts, sMBStat.Drops, sMBStat.Retries);
+}
+
+#endif
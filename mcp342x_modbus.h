@@ -0,0 +1,58 @@
+/*
+ * mcp342x_modbus.h - Copyright (c) 2021-24 Andre M. Maree/KSS Technologies (Pty) Ltd.
+ */
+
+#pragma once
+
+#include "mcp342x.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ############################################# Macros ############################################
+
+/* Register map, identical for holding (FC3) & input (FC4) registers, read only.
+ * Block base + LogCh * registers per channel, 32 bit values high word first unless swapped. */
+#define	mcp342xMB_RAW				0x0000				// i32 signed conversion code, 2 regs
+#define	mcp342xMB_UV				0x0100				// i32 micro Volts, 2 regs
+#define	mcp342xMB_FLT				0x0200				// float Volts, 2 regs
+#define	mcp342xMB_STAT				0x0300				// status, 1 reg, see below
+#define	mcp342xMB_SEQ				0x0400				// conversion sequence number, 1 reg
+#define	mcp342xMB_AGE				0x0500				// sample age mS, saturates at 0xFFFF, 1 reg
+#define	mcp342xMB_BLOCK				0x0100				// registers per block
+#define	mcp342xMB_NUM_BLK			6
+
+// Status register: b0-7 mcp342xSF_* flags, b8-9 PGA, b10-11 RATE
+#define	mcp342xMB_ST_PGA_S			8
+#define	mcp342xMB_ST_RATE_S			10
+
+#define	mcp342xMB_MAX_QTY			125					// registers per read, protocol limit
+#define	mcp342xMB_MBAP				7					// TCP header bytes
+
+// ######################################## Enumerations ###########################################
+
+enum { mcp342xMBX_FUNC = 1, mcp342xMBX_ADDR, mcp342xMBX_VALUE };	// exception codes
+
+// ######################################### Structures ############################################
+
+typedef struct mcp342x_mbstat_t {
+	u32_t Reqs;									// PDUs handled
+	u32_t Regs;									// registers returned
+	u32_t Excepts;								// exception responses
+	u32_t Drops;								// frames ignored, bad CRC/header or other unit
+	u32_t Retries;								// snapshots repeated, store updated while copying
+} mcp342x_mbstat_t;
+
+// ####################################### Public functions ########################################
+
+int	mcp342xModbusConfig(u8_t Unit, u8_t Swap);
+int	mcp342xModbusPDU(const u8_t * pu8Req, int ReqLen, u8_t * pu8Rsp, int RspSize);
+int	mcp342xModbusTCP(const u8_t * pu8Req, int ReqLen, u8_t * pu8Rsp, int RspSize);
+int	mcp342xModbusRTU(const u8_t * pu8Req, int ReqLen, u8_t * pu8Rsp, int RspSize);
+struct report_t;
+int	mcp342xModbusReport(struct report_t * psR);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,96 @@
+//test_mcp342x_log.c - Copyright (c) 2021-24 Andre M. Maree / KSS Technologies (Pty) Ltd.
+
+#include "hal_platform.h"
+
+#if (HAL_MCP342X > 0)
+#include "endpoints.h"
+#include "mcp342x_log.h"
+#include "errors_events.h"
+#include "unity.h"
+
+#include <string.h>
+
+// ##################################### Developer notes ###########################################
+
+/* The block below was encoded by hand from the format described in mcp342x_log.h, not by the
+ * encoder, so the decoder is checked against the documented format. It covers first records,
+ * implied sequence numbers, a sequence wrap, a gap, a flags change and full scale 18 bit codes
+ * in both directions. Corrupt blocks must fail without reading beyond Used.
+ */
+
+// ###################################### Local variables ##########################################
+
+#define	mcp342xTEST_TBASE			1000000UL
+
+static const u8_t Recs[] = {
+	0xE2, 0x14, 0x90, 0x01, 0x00, 0x09,					// ch2 Seq 10 Cfg 0x90 VALID, tBase, -5
+	0x02, 0x8E, 0x41, 0xE2, 0x04,						// ch2 Seq 11, +4167uS, 300
+	0xE5, 0xFE, 0xFF, 0x07, 0x9C, 0x01, 0xC8, 0x01, 0xFE, 0xFF, 0x0F,	// ch5 Seq 65535 Cfg 0x9C, tBase+100, 131071
+	0x05, 0x8E, 0x41, 0xFD, 0xFF, 0x1F,					// ch5 Seq 0 (wrap), +4167uS, -131072
+	0xA2, 0x1C, 0x03, 0xAA, 0xC3, 0x01, 0x00,			// ch2 Seq 14 (gap) VALID|STALE, +12501uS, 300
+};
+
+static const struct { u8_t LogCh, Cfg, Flags; u16_t Seq; u32_t Time; i32_t Code; } Exp[] = {
+	{ 2, 0x90, 0x01, 10, mcp342xTEST_TBASE, -5 },
+	{ 2, 0x90, 0x01, 11, mcp342xTEST_TBASE + 4167, 300 },
+	{ 5, 0x9C, 0x01, 65535, mcp342xTEST_TBASE + 100, 131071 },
+	{ 5, 0x9C, 0x01, 0, mcp342xTEST_TBASE + 4267, -131072 },
+	{ 2, 0x90, 0x03, 14, mcp342xTEST_TBASE + 16668, 300 },
+};
+
+static u8_t Blk[mcp342xLOG_BLOCK];
+static int Got;
+
+// ################################ Local ONLY utility functions ###################################
+
+static void mcp342xTestBlock(u16_t Used, u16_t NumRec) {
+	mcp342x_lbh_t sH = { .Magic = mcp342xLOG_MAGIC, .BlkNo = 7, .tBase = mcp342xTEST_TBASE, .Used = Used, .Recs = NumRec };
+	memset(Blk, 0xFF, sizeof(Blk));
+	memcpy(Blk, &sH, sizeof(sH));
+	memcpy(Blk + sizeof(sH), Recs, sizeof(Recs));
+	Got = 0;
+}
+
+static void mcp342xTestCheck(int LogCh, const mcp342x_smp_t * psSmp, void * pvCtx) {
+	int * pGot = pvCtx;
+	TEST_ASSERT_TRUE(*pGot < (int) (sizeof(Exp) / sizeof(Exp[0])));
+	TEST_ASSERT_EQUAL_INT(Exp[*pGot].LogCh, LogCh);
+	TEST_ASSERT_EQUAL_HEX8(Exp[*pGot].Cfg, psSmp->Cfg.Conf);
+	TEST_ASSERT_EQUAL_HEX8(Exp[*pGot].Flags, psSmp->Flags);
+	TEST_ASSERT_EQUAL_UINT16(Exp[*pGot].Seq, psSmp->Seq);
+	TEST_ASSERT_EQUAL_UINT32(Exp[*pGot].Time, psSmp->Time);
+	TEST_ASSERT_EQUAL_INT32(Exp[*pGot].Code, psSmp->Code);
+	++*pGot;
+}
+
+// ####################################### Test cases ##############################################
+
+TEST_CASE("mcp342x log block decode", "[mcp342x][log]") {
+	int Len = sizeof(mcp342x_lbh_t) + sizeof(Recs), Num = sizeof(Exp) / sizeof(Exp[0]);
+	mcp342xTestBlock(Len, Num);
+	TEST_ASSERT_EQUAL_INT(Num, mcp342xLogDecode(Blk, mcp342xTestCheck, &Got));
+	TEST_ASSERT_EQUAL_INT(Num, Got);
+	memset(Blk, 0xFF, sizeof(Blk));						// erased padding block
+	TEST_ASSERT_EQUAL_INT(0, mcp342xLogDecode(Blk, NULL, NULL));
+}
+
+TEST_CASE("mcp342x log block decode rejects corruption", "[mcp342x][log]") {
+	int Len = sizeof(mcp342x_lbh_t) + sizeof(Recs), Num = sizeof(Exp) / sizeof(Exp[0]);
+	mcp342xTestBlock(Len, Num);
+	Blk[0] ^= 0x01;										// not a log block
+	TEST_ASSERT_EQUAL_INT(erINV_PARA, mcp342xLogDecode(Blk, NULL, NULL));
+	mcp342xTestBlock(mcp342xLOG_BLOCK + 1, Num);
+	TEST_ASSERT_EQUAL_INT(erFAILURE, mcp342xLogDecode(Blk, NULL, NULL));
+	mcp342xTestBlock(sizeof(mcp342x_lbh_t) - 1, Num);
+	TEST_ASSERT_EQUAL_INT(erFAILURE, mcp342xLogDecode(Blk, NULL, NULL));
+	mcp342xTestBlock(Len - 2, Num);						// last varint cut short
+	TEST_ASSERT_EQUAL_INT(erFAILURE, mcp342xLogDecode(Blk, mcp342xTestCheck, &Got));
+	TEST_ASSERT_EQUAL_INT(Num - 1, Got);
+	mcp342xTestBlock(Len, Num + 1);						// record count mismatch
+	TEST_ASSERT_EQUAL_INT(erFAILURE, mcp342xLogDecode(Blk, NULL, NULL));
+	mcp342xTestBlock(Len, Num);
+	Blk[sizeof(mcp342x_lbh_t) + 6] = 0x03;				// first ch3 record without Seq/Cfg/Flags
+	TEST_ASSERT_EQUAL_INT(erFAILURE, mcp342xLogDecode(Blk, NULL, NULL));
+}
+
+#endif
@@ -0,0 +1,117 @@
+//test_mcp342x_modbus.c - Copyright (c) 2021-24 Andre M. Maree / KSS Technologies (Pty) Ltd.
+
+#include "hal_platform.h"
+
+#if (HAL_MCP342X > 0)
+#include "endpoints.h"
+#include "mcp342x_modbus.h"
+#include "unity.h"
+
+#include <string.h>
+
+// ##################################### Developer notes ###########################################
+
+/* The register server only reads the sample store, so a single fake MCP3424 (LogCh 0-3) with
+ * a hand filled store is enough, no I2C device is needed. The real globals are saved and
+ * restored around every test. Expected frames, CRCs included, were computed independently.
+ */
+
+// ###################################### Local variables ##########################################
+
+static mcp342x_t sDev;
+static mcp342x_smp_t sSS[mcp3424NUM_CHAN];
+static mcp342x_t * psSaveDev;
+static mcp342x_smp_t * psSaveSS;
+static u8_t SaveNumDev, SaveNumCh;
+
+// ################################ Local ONLY utility functions ###################################
+
+static void mcp342xTestSetup(void) {
+	psSaveDev = psaMCP342X;
+	psSaveSS = psaMCP342X_SS;
+	SaveNumDev = mcp342xNumDev;
+	SaveNumCh = mcp342xNumCh;
+	memset(&sDev, 0, sizeof(sDev));
+	sDev.ChLo = 0;
+	sDev.ChHi = mcp3424NUM_CHAN - 1;
+	memset(sSS, 0, sizeof(sSS));
+	sSS[1].Code = -1000;								// 12 bit, x1: 1mV per code, -1.000V
+	sSS[1].Flags = mcp342xSF_VALID;
+	sSS[1].Seq = 0x1234;
+	psaMCP342X = &sDev;
+	psaMCP342X_SS = sSS;
+	mcp342xNumDev = 1;
+	mcp342xNumCh = mcp3424NUM_CHAN;
+	mcp342xModbusConfig(1, 0);
+}
+
+static void mcp342xTestTeardown(void) {
+	psaMCP342X = psSaveDev;
+	psaMCP342X_SS = psSaveSS;
+	mcp342xNumDev = SaveNumDev;
+	mcp342xNumCh = SaveNumCh;
+	mcp342xModbusConfig(1, 0);
+}
+
+static void mcp342xTestExcept(u8_t FC, u16_t Addr, u16_t Qty, u8_t Code) {
+	u8_t Req[5] = { FC, Addr >> 8, Addr, Qty >> 8, Qty }, Rsp[256];
+	TEST_ASSERT_EQUAL_INT(2, mcp342xModbusPDU(Req, sizeof(Req), Rsp, sizeof(Rsp)));
+	TEST_ASSERT_EQUAL_HEX8(FC | 0x80, Rsp[0]);
+	TEST_ASSERT_EQUAL_HEX8(Code, Rsp[1]);
+}
+
+// ####################################### Test cases ##############################################
+
+TEST_CASE("mcp342x modbus RTU read raw code with CRC", "[mcp342x][modbus]") {
+	mcp342xTestSetup();
+	const u8_t Req[] = { 0x01, 0x03, 0x00, 0x02, 0x00, 0x02, 0x65, 0xCB };
+	const u8_t Exp[] = { 0x01, 0x03, 0x04, 0xFF, 0xFF, 0xFC, 0x18, 0xBB, 0x1D };
+	u8_t Rsp[32];
+	TEST_ASSERT_EQUAL_INT(sizeof(Exp), mcp342xModbusRTU(Req, sizeof(Req), Rsp, sizeof(Rsp)));
+	TEST_ASSERT_EQUAL_HEX8_ARRAY(Exp, Rsp, sizeof(Exp));
+	u8_t Bad[sizeof(Req)];
+	memcpy(Bad, Req, sizeof(Req));
+	Bad[sizeof(Bad) - 1] ^= 0x01;						// corrupt CRC, silently dropped
+	TEST_ASSERT_EQUAL_INT(0, mcp342xModbusRTU(Bad, sizeof(Bad), Rsp, sizeof(Rsp)));
+	Bad[0] = 0x02;										// other unit, dropped
+	TEST_ASSERT_EQUAL_INT(0, mcp342xModbusRTU(Bad, sizeof(Bad), Rsp, sizeof(Rsp)));
+	mcp342xTestTeardown();
+}
+
+TEST_CASE("mcp342x modbus TCP scaled values & word order", "[mcp342x][modbus]") {
+	mcp342xTestSetup();
+	// transaction 0xBEEF, unit 1, FC4 from UV register of LogCh 1, 2 regs
+	const u8_t Req[] = { 0xBE, 0xEF, 0x00, 0x00, 0x00, 0x06, 0x01, 0x04, 0x01, 0x02, 0x00, 0x02 };
+	const u8_t Exp[] = { 0xBE, 0xEF, 0x00, 0x00, 0x00, 0x07, 0x01, 0x04, 0x04, 0xFF, 0xF0, 0xBD, 0xC0 };
+	u8_t Rsp[32];
+	TEST_ASSERT_EQUAL_INT(sizeof(Exp), mcp342xModbusTCP(Req, sizeof(Req), Rsp, sizeof(Rsp)));
+	TEST_ASSERT_EQUAL_HEX8_ARRAY(Exp, Rsp, sizeof(Exp));
+	u8_t PDU[] = { 0x03, 0x02, 0x02, 0x00, 0x02 };		// float Volts of LogCh 1, -1.0f
+	TEST_ASSERT_EQUAL_INT(6, mcp342xModbusPDU(PDU, sizeof(PDU), Rsp, sizeof(Rsp)));
+	TEST_ASSERT_EQUAL_HEX8_ARRAY(((u8_t []) { 0x03, 0x04, 0xBF, 0x80, 0x00, 0x00 }), Rsp, 6);
+	mcp342xModbusConfig(1, 1);							// CDAB
+	TEST_ASSERT_EQUAL_INT(6, mcp342xModbusPDU(PDU, sizeof(PDU), Rsp, sizeof(Rsp)));
+	TEST_ASSERT_EQUAL_HEX8_ARRAY(((u8_t []) { 0x03, 0x04, 0x00, 0x00, 0xBF, 0x80 }), Rsp, 6);
+	u8_t Seq[] = { 0x03, 0x04, 0x01, 0x00, 0x01 };
+	TEST_ASSERT_EQUAL_INT(4, mcp342xModbusPDU(Seq, sizeof(Seq), Rsp, sizeof(Rsp)));
+	TEST_ASSERT_EQUAL_HEX8_ARRAY(((u8_t []) { 0x03, 0x02, 0x12, 0x34 }), Rsp, 4);
+	mcp342xTestTeardown();
+}
+
+TEST_CASE("mcp342x modbus exceptions", "[mcp342x][modbus]") {
+	mcp342xTestSetup();
+	mcp342xTestExcept(0x06, 0x0000, 1, mcp342xMBX_FUNC);			// write, not supported
+	mcp342xTestExcept(0x03, 0x0000, 0, mcp342xMBX_VALUE);
+	mcp342xTestExcept(0x03, 0x0000, mcp342xMB_MAX_QTY + 1, mcp342xMBX_VALUE);
+	mcp342xTestExcept(0x03, 0x0600, 1, mcp342xMBX_ADDR);			// beyond last block
+	mcp342xTestExcept(0x03, 0x0006, 4, mcp342xMBX_ADDR);			// runs past LogCh 3
+	mcp342xTestExcept(0x04, 0xFFFF, 2, mcp342xMBX_ADDR);			// range wraps past 0xFFFF
+	const u8_t Req[] = { 0x01, 0x03, 0xFF, 0xFF, 0x00, 0x02, 0xC4, 0x2F };
+	const u8_t Exp[] = { 0x01, 0x83, 0x02, 0xC0, 0xF1 };
+	u8_t Rsp[16];
+	TEST_ASSERT_EQUAL_INT(sizeof(Exp), mcp342xModbusRTU(Req, sizeof(Req), Rsp, sizeof(Rsp)));
+	TEST_ASSERT_EQUAL_HEX8_ARRAY(Exp, Rsp, sizeof(Exp));
+	mcp342xTestTeardown();
+}
+
+#endif